@@ -0,0 +1,52 @@
+/* Allocation: builds and frees many short-lived binary trees */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_DEPTH 16
+
+struct node {
+  struct node *left, *right;
+};
+
+static struct node *create(int depth) {
+  struct node *n = malloc(sizeof(struct node));
+  if (depth > 0) {
+    n->left = create(depth - 1);
+    n->right = create(depth - 1);
+  } else {
+    n->left = n->right = NULL;
+  }
+  return n;
+}
+
+static long check(const struct node *n) {
+  if (!n->left)
+    return 1;
+  return 1 + check(n->left) + check(n->right);
+}
+
+static void destroy(struct node *n) {
+  if (n->left) {
+    destroy(n->left);
+    destroy(n->right);
+  }
+  free(n);
+}
+
+int main(void) {
+  struct node *longLived = create(MAX_DEPTH);
+  for (int depth = 4; depth <= MAX_DEPTH; depth += 2) {
+    int iterations = 1 << (MAX_DEPTH - depth + 4);
+    long total = 0;
+    for (int i = 0; i < iterations; i++) {
+      struct node *tree = create(depth);
+      total += check(tree);
+      destroy(tree);
+    }
+    printf("%d trees of depth %d check: %ld\n", iterations, depth, total);
+  }
+  printf("long lived tree of depth %d check: %ld\n", MAX_DEPTH,
+         check(longLived));
+  destroy(longLived);
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* CPU (memory bound loops): integer matrix multiplication */
+#include <stdio.h>
+
+#define N 400
+#define ROUNDS 8
+
+static int a[N][N], b[N][N];
+static long c[N][N];
+
+int main(void) {
+  unsigned seed = 12345;
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++) {
+      seed = seed * 1103515245 + 12345;
+      a[i][j] = (seed >> 16) % 100;
+      seed = seed * 1103515245 + 12345;
+      b[i][j] = (seed >> 16) % 100;
+    }
+  long trace = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < N; i++)
+      for (int j = 0; j < N; j++) {
+        long sum = 0;
+        for (int k = 0; k < N; k++)
+          sum += (long)a[i][k] * b[k][j];
+        c[i][j] = sum;
+      }
+    for (int i = 0; i < N; i++)
+      trace += c[i][i];
+    a[round][round]++;
+  }
+  printf("trace: %ld\n", trace);
+  printf("corner: %ld %ld\n", c[0][0], c[N - 1][N - 1]);
+  return 0;
+}
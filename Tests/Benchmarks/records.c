@@ -0,0 +1,39 @@
+/* I/O: writes records to a temporary file and parses them back. The record
+   count and seed are read from stdin (records.input) */
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(void) {
+  char line[128];
+  if (!fgets(line, sizeof(line), stdin))
+    return 1;
+  int records = atoi(line);
+  if (!fgets(line, sizeof(line), stdin))
+    return 1;
+  unsigned seed = (unsigned)atoi(line);
+
+  FILE *file = tmpfile();
+  if (!file)
+    return 1;
+  for (int round = 0; round < 4; round++) {
+    rewind(file);
+    for (int i = 0; i < records; i++) {
+      seed = seed * 1103515245 + 12345;
+      fprintf(file, "%d;%u;record-%d\n", i, (seed >> 8) % 1000000, round);
+    }
+    fflush(file);
+    rewind(file);
+    long sum = 0;
+    int lines = 0;
+    while (lines < records && fgets(line, sizeof(line), file)) {
+      char *value = line;
+      while (*value && *value != ';')
+        value++;
+      sum += atoi(value + 1);
+      lines++;
+    }
+    printf("round %d: %d lines, sum %ld\n", round, lines, sum);
+  }
+  fclose(file);
+  return 0;
+}
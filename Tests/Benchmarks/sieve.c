@@ -0,0 +1,28 @@
+/* CPU (integer): sieve of Eratosthenes and a checksum over the primes */
+#include <stdio.h>
+#include <string.h>
+
+#define LIMIT 20000000
+#define ROUNDS 2
+
+static unsigned char composite[LIMIT + 1];
+
+int main(void) {
+  unsigned long checksum = 0;
+  int count = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    memset(composite, 0, sizeof(composite));
+    count = 0;
+    for (long i = 2; i <= LIMIT; i++) {
+      if (composite[i])
+        continue;
+      count++;
+      checksum = checksum * 31 + (unsigned long)i;
+      for (long j = i * i; j <= LIMIT; j += i)
+        composite[j] = 1;
+    }
+  }
+  printf("primes below %d: %d\n", LIMIT, count);
+  printf("checksum: %lu\n", checksum);
+  return 0;
+}
@@ -0,0 +1,32 @@
+// Allocation (C++): builds words, counts them in a map and sorts them
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+int main() {
+  unsigned seed = 42;
+  std::map<std::string, int> counts;
+  std::vector<std::string> words;
+  for (int i = 0; i < 1000000; i++) {
+    std::string word;
+    seed = seed * 1103515245 + 12345;
+    int length = 2 + (seed >> 16) % 4;
+    for (int j = 0; j < length; j++) {
+      seed = seed * 1103515245 + 12345;
+      word += (char)('a' + (seed >> 16) % 8);
+    }
+    counts[word]++;
+    words.push_back(word);
+  }
+  std::sort(words.begin(), words.end());
+  auto best = std::max_element(
+      counts.begin(), counts.end(),
+      [](const auto &a, const auto &b) { return a.second < b.second; });
+  std::printf("distinct words: %zu\n", counts.size());
+  std::printf("most frequent: %s (%d)\n", best->first.c_str(), best->second);
+  std::printf("first and last: %s %s\n", words.front().c_str(),
+              words.back().c_str());
+  return 0;
+}
@@ -0,0 +1,24 @@
+// Test an invoked operator new[] and a stack array in one function. The
+// sidedata runtime mode tags the new on a split edge before the stack array
+// gets its inline check.
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+int main() {
+  char stack[16];
+  char *heap;
+  try {
+    heap = new char[32];
+  } catch (const std::bad_alloc &) {
+    std::printf("allocation failed\n");
+    return 1;
+  }
+  for (int i = 0; i < 15; i++)
+    stack[i] = 'a' + i;
+  stack[15] = 0;
+  std::strcpy(heap, stack);
+  std::printf("%s %s\n", stack, heap);
+  delete[] heap;
+  return 0;
+}
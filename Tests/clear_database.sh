@@ -6,14 +6,21 @@ if [[ ! -f "$DB_PATH" ]]; then
   exit 1
 fi
 
+# databases created before the benchmark tables existed get them first
+sqlite3 "$DB_PATH" < "${SCRIPT_DIR}/results.sql"
+
 sqlite3 "$DB_PATH" <<'SQL'
 PRAGMA foreign_keys = ON;
 BEGIN;
 DELETE FROM test_results;
+DELETE FROM step_measurements;
+DELETE FROM pass_timings;
+DELETE FROM benchmark_statistics;
+DELETE FROM benchmark_run_resources;
 DELETE FROM benchmark_runs;
 DELETE FROM program_measurements;
 DELETE FROM measurements;
-DELETE FROM sqlite_sequence WHERE name IN ('test_results', 'benchmark_runs', 'program_measurements', 'measurements');
+DELETE FROM sqlite_sequence WHERE name IN ('test_results', 'step_measurements', 'pass_timings', 'benchmark_statistics', 'benchmark_run_resources', 'benchmark_runs', 'program_measurements', 'measurements');
 COMMIT;
 SQL
 
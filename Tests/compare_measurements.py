@@ -0,0 +1,158 @@
+#!/usr/bin/python
+import argparse
+import math
+import sqlite3
+import sys
+
+# metric -> (label, SQL expression per program measurement pm)
+METRICS = {
+    "binary_size": ("binary size", "pm.binary_size_bytes"),
+    "text_size": (".text size", "pm.text_size_bytes"),
+    # the benchmark median if the program was benchmarked, otherwise the single run of the test
+    "runtime": (
+        "runtime",
+        """COALESCE(
+            (SELECT median FROM benchmark_statistics
+             WHERE program_measurement_id = pm.id AND metric = 'wall_seconds'),
+            (SELECT wall_seconds FROM step_measurements WHERE program_measurement_id = pm.id AND step = 'run'))""",
+    ),
+    "compile_time": (
+        "compile time",
+        """(SELECT SUM(cpu_seconds) FROM step_measurements
+            WHERE program_measurement_id = pm.id AND step != 'run')""",
+    ),
+}
+
+parser = argparse.ArgumentParser(
+    description="Compares a measurement with its baseline per program and as geometric mean over all programs. "
+    "Exits with 1 if a threshold is exceeded",
+)
+parser.add_argument("database")
+parser.add_argument("measurement", help="Name of the measurement (the latest one with that name)")
+parser.add_argument("--baseline", help="Name of the baseline measurement (default: the measurement's baseline_id)")
+parser.add_argument("--worst", type=int, default=5, help="Number of worst offenders listed per metric")
+parser.add_argument(
+    "--max",
+    action="append",
+    default=[],
+    metavar="METRIC=PERCENT",
+    help=f"Maximal increase of the geometric mean of a metric ({', '.join(METRICS)}), e.g. runtime=5",
+)
+parser.add_argument(
+    "--max-program",
+    action="append",
+    default=[],
+    metavar="METRIC=PERCENT",
+    help="Maximal increase of a metric for any single program, e.g. text_size=20",
+)
+args = parser.parse_args()
+
+
+def parse_thresholds(values: list[str]) -> dict[str, float]:
+    thresholds = {}
+    for value in values:
+        metric, _, percent = value.partition("=")
+        if metric not in METRICS:
+            parser.error(f"unknown metric '{metric}', expected one of {', '.join(METRICS)}")
+        try:
+            thresholds[metric] = float(percent)
+        except ValueError:
+            parser.error(f"invalid threshold '{value}', expected METRIC=PERCENT")
+    return thresholds
+
+
+def find_measurement(name: str):
+    return cur.execute(
+        "SELECT id, baseline_id FROM measurements WHERE name = ? ORDER BY id DESC LIMIT 1", (name,)
+    ).fetchone()
+
+
+def program_values(measurement_id: int) -> dict[str, dict[str, float]]:
+    columns = ", ".join(f"{expression} AS {metric}" for metric, (_, expression) in METRICS.items())
+    rows = cur.execute(
+        f"""
+        SELECT p.name, {columns}
+        FROM program_measurements pm
+        JOIN programs p ON p.id = pm.program_id
+        LEFT JOIN test_results t ON t.program_measurement_id = pm.id
+        WHERE pm.measurement_id = ? AND COALESCE(t.passed, 1)
+        """,
+        (measurement_id,),
+    ).fetchall()
+    return {row[0]: dict(zip(METRICS, row[1:])) for row in rows}
+
+
+def format_delta(ratio: float) -> str:
+    return f"{(ratio - 1) * 100:+.1f}%"
+
+
+max_geomean = parse_thresholds(args.max)
+max_program = parse_thresholds(args.max_program)
+
+conn = sqlite3.connect(args.database)
+cur = conn.cursor()
+
+measurement = find_measurement(args.measurement)
+if not measurement:
+    print(f"error: no measurement found with name '{args.measurement}'", file=sys.stderr)
+    sys.exit(2)
+baseline_id = measurement[1]
+if args.baseline:
+    baseline = find_measurement(args.baseline)
+    if not baseline:
+        print(f"error: no measurement found with name '{args.baseline}'", file=sys.stderr)
+        sys.exit(2)
+    baseline_id = baseline[0]
+if not baseline_id or baseline_id == measurement[0]:
+    print(f"error: measurement '{args.measurement}' has no baseline, use --baseline", file=sys.stderr)
+    sys.exit(2)
+
+current = program_values(measurement[0])
+reference = program_values(baseline_id)
+programs = sorted(set(current) & set(reference))
+print(f"Comparing {len(programs)} program(s) passing in both measurements "
+      f"({len(current)} in '{args.measurement}', {len(reference)} in the baseline)")
+
+# ratio of every metric per program, only where both values exist
+ratios = {metric: {} for metric in METRICS}
+for program in programs:
+    for metric in METRICS:
+        base, value = reference[program][metric], current[program][metric]
+        if base and value is not None:
+            ratios[metric][program] = value / base
+
+violations = []
+print()
+print("metric        programs  geomean   worst")
+print("------------  --------  --------  -----")
+for metric, (label, _) in METRICS.items():
+    values = ratios[metric]
+    if not values:
+        print(f"{label:<12}  {0:>8}  {'-':>8}  -")
+        continue
+    geomean = math.exp(sum(math.log(ratio) for ratio in values.values()) / len(values))
+    worst = max(values, key=lambda program: (values[program], program))
+    print(f"{label:<12}  {len(values):>8}  {format_delta(geomean):>8}  {worst} {format_delta(values[worst])}")
+    if metric in max_geomean and (geomean - 1) * 100 > max_geomean[metric]:
+        violations.append(f"geometric mean of {label} {format_delta(geomean)} exceeds +{max_geomean[metric]}%")
+    if metric in max_program:
+        for program, ratio in sorted(values.items()):
+            if (ratio - 1) * 100 > max_program[metric]:
+                violations.append(f"{label} of {program} {format_delta(ratio)} exceeds +{max_program[metric]}%")
+
+for metric, (label, _) in METRICS.items():
+    values = ratios[metric]
+    if not values or args.worst <= 0:
+        continue
+    print()
+    print(f"Worst offenders by {label}:")
+    for program in sorted(values, key=lambda program: (-values[program], program))[:args.worst]:
+        print(f"  {format_delta(values[program]):>8}  {reference[program][metric]:.6g} -> "
+              f"{current[program][metric]:.6g}  {program}")
+
+conn.close()
+if violations:
+    print()
+    for violation in violations:
+        print(f"THRESHOLD EXCEEDED: {violation}")
+    sys.exit(1)
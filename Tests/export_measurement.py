@@ -67,6 +67,9 @@ if program_ids:
 program_measurement_ids = [row["id"] for row in program_measurements]
 test_results = []
 benchmark_runs = []
+benchmark_statistics = []
+step_measurements = []
+pass_timings = []
 if program_measurement_ids:
     placeholders = ",".join("?" for _ in program_measurement_ids)
     test_results = cur.execute(
@@ -77,6 +80,27 @@ if program_measurement_ids:
         f"SELECT * FROM benchmark_runs WHERE program_measurement_id IN ({placeholders}) ORDER BY id",
         program_measurement_ids,
     ).fetchall()
+    step_measurements = cur.execute(
+        f"SELECT * FROM step_measurements WHERE program_measurement_id IN ({placeholders}) ORDER BY id",
+        program_measurement_ids,
+    ).fetchall()
+    pass_timings = cur.execute(
+        f"SELECT * FROM pass_timings WHERE program_measurement_id IN ({placeholders}) ORDER BY id",
+        program_measurement_ids,
+    ).fetchall()
+    benchmark_statistics = cur.execute(
+        f"SELECT * FROM benchmark_statistics WHERE program_measurement_id IN ({placeholders}) ORDER BY id",
+        program_measurement_ids,
+    ).fetchall()
+
+benchmark_run_ids = [row["id"] for row in benchmark_runs]
+benchmark_run_resources = []
+if benchmark_run_ids:
+    placeholders = ",".join("?" for _ in benchmark_run_ids)
+    benchmark_run_resources = cur.execute(
+        f"SELECT * FROM benchmark_run_resources WHERE benchmark_run_id IN ({placeholders}) ORDER BY id",
+        benchmark_run_ids,
+    ).fetchall()
 
 lines = [
     "-- Export generated by export_measurement.sh",
@@ -103,11 +127,22 @@ lines.extend(
 lines.extend(
     insert_lines(
         "program_measurements",
-        ["id", "measurement_id", "program_id", "embedding_log", "watermarks_added", "binary_size_bytes"],
+        ["id", "measurement_id", "program_id", "embedding_log", "watermarks_added", "binary_size_bytes",
+         "text_size_bytes"],
         program_measurements,
     )
 )
 lines.extend(insert_lines("test_results", ["id", "program_measurement_id", "passed"], test_results))
+lines.extend(
+    insert_lines(
+        "step_measurements",
+        ["id", "program_measurement_id", "step", "wall_seconds", "cpu_seconds", "max_rss_kb"],
+        step_measurements,
+    )
+)
+lines.extend(
+    insert_lines("pass_timings", ["id", "program_measurement_id", "name", "count", "seconds"], pass_timings)
+)
 lines.extend(
     insert_lines(
         "benchmark_runs",
@@ -115,6 +150,20 @@ lines.extend(
         benchmark_runs,
     )
 )
+lines.extend(
+    insert_lines(
+        "benchmark_run_resources",
+        ["id", "benchmark_run_id", "user_seconds", "max_rss_kb"],
+        benchmark_run_resources,
+    )
+)
+lines.extend(
+    insert_lines(
+        "benchmark_statistics",
+        ["id", "program_measurement_id", "metric", "repetitions", "median", "mad", "ci_low", "ci_high"],
+        benchmark_statistics,
+    )
+)
 lines.append("COMMIT;")
 lines.append("")
 
@@ -0,0 +1,78 @@
+#!/usr/bin/python
+import re
+import sqlite3
+import sys
+
+db_path = sys.argv[1]
+measurement_name = sys.argv[2]
+limit = int(sys.argv[3]) if len(sys.argv) > 3 else 20
+
+# phases of the watermark passes are TimeTraceScopes named <Technique>::<phase>
+PHASE = re.compile(r"^\w+::\w+$")
+
+conn = sqlite3.connect(db_path)
+cur = conn.cursor()
+
+measurement = cur.execute(
+    "SELECT id FROM measurements WHERE name = ? ORDER BY id DESC LIMIT 1", (measurement_name,)
+).fetchone()
+if not measurement:
+    print(f"No measurement found with name '{measurement_name}'")
+    sys.exit(1)
+
+# the embed step runs the same pipeline as the optimize step plus the watermark pass
+rows = cur.execute(
+    """
+    SELECT
+        pm.id,
+        p.name,
+        opt.wall_seconds,
+        embed.wall_seconds,
+        opt.max_rss_kb,
+        embed.max_rss_kb
+    FROM program_measurements pm
+    JOIN programs p ON p.id = pm.program_id
+    JOIN step_measurements opt ON opt.program_measurement_id = pm.id AND opt.step = 'optimize'
+    JOIN step_measurements embed ON embed.program_measurement_id = pm.id AND embed.step = 'embed'
+    WHERE pm.measurement_id = ? AND opt.wall_seconds > 0
+    ORDER BY embed.wall_seconds / opt.wall_seconds DESC, p.name
+    """,
+    (measurement[0],),
+).fetchall()
+
+if not rows:
+    print("No embed and optimize step timings found.")
+    sys.exit(0)
+
+headers = ["program", "opt_s", "embed_s", "overhead", "opt_rss_kb", "embed_rss_kb", "slowest_phases"]
+table_rows = []
+for program_measurement_id, name, opt_seconds, embed_seconds, opt_rss, embed_rss in rows[:limit]:
+    phases = [
+        (phase, seconds)
+        for phase, seconds in cur.execute(
+            "SELECT name, seconds FROM pass_timings WHERE program_measurement_id = ? ORDER BY seconds DESC",
+            (program_measurement_id,),
+        )
+        if PHASE.match(phase)
+    ]
+    table_rows.append([
+        name,
+        f"{opt_seconds:.3f}",
+        f"{embed_seconds:.3f}",
+        f"{embed_seconds / opt_seconds:.2f}x",
+        str(opt_rss),
+        str(embed_rss),
+        ", ".join(f"{phase} {seconds:.3f}s" for phase, seconds in phases[:3]) or "-",
+    ])
+
+widths = [len(h) for h in headers]
+for tr in table_rows:
+    for i, value in enumerate(tr):
+        widths[i] = max(widths[i], len(value))
+
+print("  ".join(headers[i].ljust(widths[i]) for i in range(len(headers))))
+print("  ".join("-" * widths[i] for i in range(len(headers))))
+for tr in table_rows:
+    print("  ".join(tr[i].ljust(widths[i]) for i in range(len(tr))))
+
+conn.close()
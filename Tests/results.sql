@@ -1,4 +1,4 @@
-CREATE TABLE measurements (
+CREATE TABLE IF NOT EXISTS measurements (
     id INTEGER PRIMARY KEY AUTOINCREMENT,
     name TEXT NOT NULL,
     started_at TIMESTAMP NOT NULL,
@@ -17,13 +17,13 @@ CREATE TABLE measurements (
 );
 
 
-CREATE TABLE programs (
+CREATE TABLE IF NOT EXISTS programs (
     id INTEGER PRIMARY KEY AUTOINCREMENT,
     name TEXT NOT NULL UNIQUE
 );
 
 
-CREATE TABLE program_measurements (
+CREATE TABLE IF NOT EXISTS program_measurements (
     id INTEGER PRIMARY KEY AUTOINCREMENT,
 
     measurement_id INTEGER NOT NULL,
@@ -32,6 +32,7 @@ CREATE TABLE program_measurements (
     embedding_log TEXT,
     watermarks_added INTEGER,
     binary_size_bytes INTEGER,
+    text_size_bytes INTEGER,
 
     FOREIGN KEY(measurement_id) REFERENCES measurements(id),
     FOREIGN KEY(program_id) REFERENCES programs(id),
@@ -40,7 +41,7 @@ CREATE TABLE program_measurements (
 );
 
 
-CREATE TABLE test_results (
+CREATE TABLE IF NOT EXISTS test_results (
     id INTEGER PRIMARY KEY AUTOINCREMENT,
 
     program_measurement_id INTEGER NOT NULL,
@@ -54,7 +55,7 @@ CREATE TABLE test_results (
 );
 
 
-CREATE TABLE benchmark_runs (
+CREATE TABLE IF NOT EXISTS benchmark_runs (
     id INTEGER PRIMARY KEY AUTOINCREMENT,
 
     program_measurement_id INTEGER NOT NULL,
@@ -68,3 +69,70 @@ CREATE TABLE benchmark_runs (
 
     UNIQUE(program_measurement_id, iteration)
 );
+
+
+CREATE TABLE IF NOT EXISTS benchmark_run_resources (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+
+    benchmark_run_id INTEGER NOT NULL,
+
+    user_seconds REAL,
+    max_rss_kb INTEGER,
+
+    FOREIGN KEY(benchmark_run_id)
+        REFERENCES benchmark_runs(id),
+
+    UNIQUE(benchmark_run_id)
+);
+
+
+CREATE TABLE IF NOT EXISTS benchmark_statistics (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+
+    program_measurement_id INTEGER NOT NULL,
+
+    metric TEXT NOT NULL,
+    repetitions INTEGER NOT NULL,
+    median REAL,
+    mad REAL,
+    ci_low REAL,
+    ci_high REAL,
+
+    FOREIGN KEY(program_measurement_id)
+        REFERENCES program_measurements(id),
+
+    UNIQUE(program_measurement_id, metric)
+);
+
+
+CREATE TABLE IF NOT EXISTS step_measurements (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+
+    program_measurement_id INTEGER NOT NULL,
+
+    step TEXT NOT NULL,
+    wall_seconds REAL,
+    cpu_seconds REAL,
+    max_rss_kb INTEGER,
+
+    FOREIGN KEY(program_measurement_id)
+        REFERENCES program_measurements(id),
+
+    UNIQUE(program_measurement_id, step)
+);
+
+
+CREATE TABLE IF NOT EXISTS pass_timings (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+
+    program_measurement_id INTEGER NOT NULL,
+
+    name TEXT NOT NULL,
+    count INTEGER NOT NULL,
+    seconds REAL NOT NULL,
+
+    FOREIGN KEY(program_measurement_id)
+        REFERENCES program_measurements(id),
+
+    UNIQUE(program_measurement_id, name)
+);
@@ -1,18 +1,44 @@
 #!/usr/bin/python
 import argparse
+import ctypes
 import datetime
+import functools
+import json
+import math
+import multiprocessing
+import os
 import re
 import shlex
+import signal
 import sqlite3
+import statistics
+import struct
 import subprocess
 import tempfile
+import threading
+import time
+from concurrent.futures import ProcessPoolExecutor
 from pathlib import Path
 
 
 TEST_ROOT = Path(__file__).resolve().parent
 REPO_ROOT = TEST_ROOT.parent
 TEST_DIRECTORIES = ("Regression", "UnitTests", "c-testsuite")
+BENCHMARK_DIRECTORIES = ("Benchmarks",)
+BENCHMARK_METRICS = ("wall_seconds", "user_seconds", "max_rss_kb")
+# program results written to the database per transaction
+DB_BATCH_SIZE = 64
+PIPELINE_STEPS = ("compile-to-llvm", "optimize", "embed", "compile-binary", "run")
+PTRACE_TRACEME, PTRACE_CONT, PTRACE_SETOPTIONS = 0, 7, 0x4200
+# follow forks, clones and execs of the traced process and stop every process right before its exit
+PTRACE_OPTIONS = 0x2 | 0x4 | 0x8 | 0x10 | 0x40
+PTRACE_EVENT_EXIT = 6
+WAIT_ALL = 0x40000000
+libc = ctypes.CDLL(None, use_errno=True)
+libc.ptrace.argtypes = [ctypes.c_long, ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p]
 CXX_EXTENSIONS = {".cpp", ".cc", ".cxx", ".c++"}
+# ./ and ../ paths of a command template, alone or after an = or a quote
+RELATIVE_PATH = re.compile(r"(?<![^\s=\"'])(\.\.?/[^\s\"']*)")
 
 parser = argparse.ArgumentParser(
     prog="Softwater Test and Benchmark Suite",
@@ -35,7 +61,8 @@ parser.add_argument(
 )
 parser.add_argument(
     "--embed",
-    help="Defines the command to embed watermarks in LLVM IR. Use the [file] makro as placeholder for the filename",
+    help="Defines the command to embed watermarks in LLVM IR. Use the [file] makro as placeholder for the filename "
+    "and optionally [time_trace] for a -time-trace-file whose pass and phase timings are stored",
     default="",
 )
 parser.add_argument(
@@ -58,7 +85,42 @@ parser.add_argument(
     "-b",
     "--benchmark",
     action="store_true",
-    help="Compiles, tests, and benchmarks all programs in Benchmarks/",
+    help="Compiles, tests, and benchmarks all programs in Benchmarks/, once without (baseline) and once with --embed",
+)
+parser.add_argument(
+    "-w",
+    "--warmup",
+    type=int,
+    default=1,
+    help="Number of untimed runs of every benchmark binary before the measurement",
+)
+parser.add_argument(
+    "-r",
+    "--repetitions",
+    type=int,
+    default=10,
+    help="Number of timed runs of every benchmark binary",
+)
+parser.add_argument(
+    "--timeout",
+    type=int,
+    help="Seconds after which a run is killed and counted as failed (default 30 for tests, 300 for benchmarks)",
+)
+parser.add_argument(
+    "-j",
+    "--jobs",
+    type=int,
+    default=1,
+    help="Number of programs compiled and tested in parallel. Benchmark runs are always timed one at a time",
+)
+parser.add_argument(
+    "--shard",
+    help="Only handles every n-th program starting with the i-th (i/n, 1 <= i <= n), to split a run across machines",
+)
+parser.add_argument(
+    "--baseline",
+    help="Name of an earlier run without watermarks (e.g. with an empty --embed) that this test run is compared to "
+    "by compare_measurements.py. Benchmark runs always build and link their own baseline",
 )
 parser.add_argument("-s", "--store", default="results.db", help="Database to store the compile logs and results")
 parser.suggest_on_error = True
@@ -89,15 +151,23 @@ def parse_wm_count(log_text: str) -> int:
     return int(match.group(1)) if match else 0
 
 
-def ensure_schema(conn: sqlite3.Connection) -> None:
-    has_measurements = conn.execute(
-        "SELECT 1 FROM sqlite_master WHERE type='table' AND name='measurements'"
-    ).fetchone()
-    if has_measurements:
-        return
+def open_database(db_path: Path) -> sqlite3.Connection:
+    """Opens the database in WAL mode, only the main process writes to it"""
+    conn = sqlite3.connect(db_path)
+    conn.execute("PRAGMA journal_mode=WAL")
+    conn.execute("PRAGMA synchronous=NORMAL")
+    ensure_schema(conn)
+    return conn
+
 
-    schema_path = REPO_ROOT / "results.sql"
+def ensure_schema(conn: sqlite3.Connection) -> None:
+    # every table is created if it does not exist, older databases get the new tables
+    schema_path = TEST_ROOT / "results.sql"
     conn.executescript(schema_path.read_text(encoding="utf-8"))
+    # columns added after the table was created
+    columns = {row[1] for row in conn.execute("PRAGMA table_info(program_measurements)")}
+    if "text_size_bytes" not in columns:
+        conn.execute("ALTER TABLE program_measurements ADD COLUMN text_size_bytes INTEGER")
     conn.commit()
 
 
@@ -108,24 +178,151 @@ def baseline_value(conn: sqlite3.Connection):
         if row[1] == "baseline_id":
             baseline_not_null = bool(row[3])
             break
+    if args.baseline:
+        row = conn.execute(
+            "SELECT id FROM measurements WHERE name = ? ORDER BY id DESC LIMIT 1", (args.baseline,)
+        ).fetchone()
+        if not row:
+            parser.error(f"no measurement found with name '{args.baseline}'")
+        return row[0]
     return 0 if baseline_not_null else None
 
 
+def text_size(binary_path: Path):
+    """Size of the .text section of an ELF binary, None for other files"""
+    try:
+        data = binary_path.read_bytes()
+    except OSError:
+        return None
+    if data[:4] != b"\x7fELF":
+        return None
+    is64 = data[4] == 2
+    endian = "<" if data[5] == 1 else ">"
+    if is64:
+        shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x3A)
+        section = endian + "IIQQQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+        section = endian + "IIIIII"
+    # sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size
+    headers = [struct.unpack_from(section, data, shoff + index * shentsize) for index in range(shnum)]
+    if shstrndx >= len(headers):
+        return None
+    names_offset = headers[shstrndx][4]
+    for header in headers:
+        name_start = names_offset + header[0]
+        if data[name_start:data.index(b"\0", name_start)] == b".text":
+            return header[5]
+    return None
+
+
 def render_command(command_template: str, replacements: dict[str, str]) -> str:
-    command = command_template
+    """Fills in the makros. The steps run in the program's build directory, so ./ and ../ paths of the template are
+    made absolute relative to the repository root"""
+    command = RELATIVE_PATH.sub(lambda match: str((REPO_ROOT / match.group(1)).resolve()), command_template)
     for key, value in replacements.items():
         command = command.replace(f"[{key}]", shlex.quote(value))
     return command
 
 
-def run_shell_command(command: str, cwd: Path) -> tuple[int, str]:
-    process = subprocess.run(command, shell=True, cwd=cwd, capture_output=True, text=True)
-    return process.returncode, process.stdout + process.stderr
+def peak_rss_kb(pid: int):
+    try:
+        with open(f"/proc/{pid}/status", encoding="utf-8") as status:
+            for line in status:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return None
+
+
+def run_measured(command, cwd: Path, stdin=None, stdout=None, stderr=None, timeout=None):
+    """Runs command (a shell command line or an argument list) and measures it.
+    Returns the exit code (None if it was killed after timeout seconds) and the wall time, the user and the CPU
+    (user + system) time of the process and its descendants and the peak RSS (KB) of its largest process.
+    ru_maxrss would also cover the copy of this script the child was forked from, so every process of the
+    command is traced and stopped right before its exit, where VmHWM is the peak of that process alone."""
+    start = time.perf_counter()
+    process = subprocess.Popen(
+        command,
+        shell=isinstance(command, str),
+        cwd=cwd,
+        stdin=stdin,
+        stdout=stdout,
+        stderr=stderr,
+        preexec_fn=lambda: libc.ptrace(PTRACE_TRACEME, 0, None, None),
+    )
+    timed_out = threading.Event()
+    timer = threading.Timer(timeout, lambda: (timed_out.set(), process.kill())) if timeout else None
+    if timer:
+        timer.start()
+    max_rss = 0
+    traced = set()
+    while True:
+        pid, status, usage = os.wait4(-1, WAIT_ALL)
+        if not os.WIFSTOPPED(status):
+            if pid == process.pid:
+                break
+            continue
+        stop_signal = os.WSTOPSIG(status)
+        if stop_signal == signal.SIGTRAP and status >> 16 == PTRACE_EVENT_EXIT:
+            max_rss = max(max_rss, peak_rss_kb(pid) or 0)
+            stop_signal = 0
+        elif stop_signal == signal.SIGTRAP and status >> 16:
+            # fork, clone and exec events
+            stop_signal = 0
+        elif pid == process.pid and pid not in traced:
+            # stop after the exec of the command
+            libc.ptrace(PTRACE_SETOPTIONS, pid, None, PTRACE_OPTIONS)
+            stop_signal = 0
+        elif stop_signal == signal.SIGSTOP and pid not in traced:
+            # new processes and threads start stopped
+            stop_signal = 0
+        traced.add(pid)
+        libc.ptrace(PTRACE_CONT, pid, None, stop_signal)
+    wall = time.perf_counter() - start
+    if timer:
+        timer.cancel()
+    # wait4 already reaped the process
+    process.returncode = os.waitstatus_to_exitcode(status)
+    return None if timed_out.is_set() else process.returncode, {
+        "wall_seconds": wall,
+        "user_seconds": usage.ru_utime,
+        "cpu_seconds": usage.ru_utime + usage.ru_stime,
+        "max_rss_kb": max_rss or usage.ru_maxrss,
+    }
+
+
+def run_shell_command(command: str, cwd: Path) -> tuple[int, str, dict]:
+    with tempfile.TemporaryFile() as output:
+        rc, resources = run_measured(command, cwd, stdout=output, stderr=subprocess.STDOUT)
+        output.seek(0)
+        return rc, output.read().decode("utf-8", errors="replace"), resources
+
+
+def parse_time_trace(trace_path: Path) -> dict[str, tuple[int, float]]:
+    """Number of events and their total duration in seconds per event name of a -time-trace JSON file,
+    e.g. per pass and analysis of opt and per phase (TimeTraceScope) of the watermark passes"""
+    timings: dict[str, tuple[int, float]] = {}
+    try:
+        trace = json.loads(trace_path.read_text(encoding="utf-8"))
+    except (OSError, ValueError):
+        return timings
+    for event in trace.get("traceEvents", []):
+        name = event.get("name", "")
+        # LLVM appends a "Total <name>" event for every name
+        if event.get("ph") != "X" or name.startswith("Total "):
+            continue
+        count, seconds = timings.get(name, (0, 0.0))
+        timings[name] = (count + 1, seconds + event.get("dur", 0) / 1e6)
+    return timings
 
 
-def ls_test_programs() -> list[Path]:
+def ls_test_programs(directories=TEST_DIRECTORIES) -> list[Path]:
     programs: list[Path] = []
-    for folder in TEST_DIRECTORIES:
+    for folder in directories:
         base_path = TEST_ROOT / folder
         if not base_path.exists():
             continue
@@ -136,24 +333,35 @@ def ls_test_programs() -> list[Path]:
             if reference_path.exists():
                 programs.append(source)
     programs.sort(key=lambda path: path.relative_to(TEST_ROOT).as_posix())
+    if args.shard:
+        shard, shards = parse_shard(args.shard)
+        programs = programs[shard - 1::shards]
     return programs
 
 
+def parse_shard(text: str) -> tuple[int, int]:
+    match = re.fullmatch(r"(\d+)/(\d+)", text)
+    if not match or not 1 <= int(match.group(1)) <= int(match.group(2)):
+        parser.error(f"invalid --shard '{text}', expected i/n with 1 <= i <= n")
+    return int(match.group(1)), int(match.group(2))
+
+
+def run_pipelines(function, items: list):
+    """Applies function to every item in args.jobs worker processes, the results keep the order of the items"""
+    if args.jobs <= 1:
+        yield from map(function, items)
+        return
+    # fork, the workers share the parsed arguments and do not re-run this script
+    with ProcessPoolExecutor(max_workers=args.jobs, mp_context=multiprocessing.get_context("fork")) as executor:
+        yield from executor.map(function, items)
+
+
 def ensure_program(conn: sqlite3.Connection, program_name: str) -> int:
     conn.execute("INSERT OR IGNORE INTO programs(name) VALUES (?)", (program_name,))
     row = conn.execute("SELECT id FROM programs WHERE name = ?", (program_name,)).fetchone()
     return row[0]
 
-args = parser.parse_args()
-
-if args.test:
-    db_path = Path(args.store)
-    run_name = args.name or f"{datetime.datetime.now().strftime('%Y%m%d_%H%M%S')}_test"
-    programs = ls_test_programs()
-
-    conn = sqlite3.connect(db_path)
-    ensure_schema(conn)
-
+def insert_measurement(conn: sqlite3.Connection, name: str, embed: str, tests: bool, benchmarks: bool, baseline_id) -> int:
     measurement_id = conn.execute(
         """
         INSERT INTO measurements (
@@ -161,121 +369,352 @@ if args.test:
             embedding_cmd, compile_cmd, tests_executed, benchmarks_executed, baseline_id
         ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
         """,
-        (run_name,
+        (name,
          datetime.datetime.now().isoformat(timespec="seconds"),
          args.c_compiler,
          args.cpp_compiler,
          args.optimize,
-         args.embed,
+         embed,
          args.compile,
-         True, False,
-         baseline_value(conn)),
+         tests, benchmarks,
+         baseline_id),
     ).lastrowid
     conn.commit()
+    return measurement_id
+
+
+def insert_program_measurement(conn: sqlite3.Connection, measurement_id: int, result: dict) -> int:
+    """Adds the result of test_program, the caller commits"""
+    rel_name = result["rel_name"]
+    embedding_log = result["embedding_log"]
+    watermark_count = parse_wm_count(embedding_log)
+    binary_size = result["binary_size"]
+    passed = result["passed"]
+
+    program_id = ensure_program(conn, rel_name)
+    program_measurement_id = conn.execute(
+        """
+        INSERT INTO program_measurements (
+            measurement_id, program_id, embedding_log, watermarks_added, binary_size_bytes, text_size_bytes
+        ) VALUES (?, ?, ?, ?, ?, ?)
+        """,
+        (measurement_id, program_id, embedding_log, watermark_count, binary_size, result["text_size"]),
+    ).lastrowid
+
+    conn.execute(
+        "INSERT INTO test_results (program_measurement_id, passed) VALUES (?, ?)",
+        (program_measurement_id, passed),
+    )
+    conn.executemany(
+        """
+        INSERT INTO step_measurements (
+            program_measurement_id, step, wall_seconds, cpu_seconds, max_rss_kb
+        ) VALUES (?, ?, ?, ?, ?)
+        """,
+        [(program_measurement_id, step, resources["wall_seconds"], resources["cpu_seconds"], resources["max_rss_kb"])
+         for step, resources in result["steps"].items()],
+    )
+    conn.executemany(
+        "INSERT INTO pass_timings (program_measurement_id, name, count, seconds) VALUES (?, ?, ?, ?)",
+        [(program_measurement_id, name, count, seconds) for name, (count, seconds) in result["pass_timings"].items()],
+    )
+    return program_measurement_id
+
+
+def build_program(source_path: Path, build_dir: Path, embed: str) -> tuple[bool, str, Path, dict, dict]:
+    """Compiles source_path to LLVM IR, optimizes it, embeds the watermark (if embed is set) and compiles the binary.
+    Returns whether all steps succeeded, the embedding log (or the log of the failed step), the binary path,
+    the resources of every executed step and the timings of the embed step's [time_trace] file (if used)."""
+    build_dir.mkdir(parents=True, exist_ok=True)
+    llvm_path = build_dir / f"{source_path.stem}.ll"
+    binary_path = build_dir / f"{source_path.stem}.out"
+    trace_path = build_dir / f"{source_path.stem}.time-trace.json"
+    comp_temp = args.cpp_compiler if source_path.suffix in CXX_EXTENSIONS else args.c_compiler
+    to_llvm_cmd = render_command(
+        comp_temp, {"input": str(source_path), "output": str(llvm_path)}
+    )
+    optimize_cmd = render_command(args.optimize, {"file": str(llvm_path)})
+    embed_cmd = render_command(
+        embed, {"file": str(llvm_path), "time_trace": str(trace_path)}
+    ) if embed.strip() else ""
+    comp_cmd = render_command(
+        args.compile, {"input": str(llvm_path), "output": str(binary_path)}
+    )
+    step_ok = True
+    embedding_log = ""
+    steps = {}
+
+    rc, log, steps["compile-to-llvm"] = run_shell_command(to_llvm_cmd, cwd=build_dir)
+    if rc != 0:
+        step_ok = False
+        embedding_log = f"[compile-to-llvm]\n{log}"
+
+    if step_ok:
+        rc, log, steps["optimize"] = run_shell_command(optimize_cmd, cwd=build_dir)
+        if rc != 0:
+            step_ok = False
+            embedding_log = f"[optimize]\n{log}"
+
+    if step_ok and embed_cmd:
+        rc, log, steps["embed"] = run_shell_command(embed_cmd, cwd=build_dir)
+        embedding_log = log
+        if rc != 0:
+            step_ok = False
+            embedding_log = f"[embed]\n{log}"
+
+    if step_ok:
+        rc, log, steps["compile-binary"] = run_shell_command(comp_cmd, cwd=build_dir)
+        if rc != 0:
+            step_ok = False
+            if embedding_log:
+                embedding_log = f"{embedding_log}\n[compile-binary]\n{log}"
+            else:
+                embedding_log = f"[compile-binary]\n{log}"
+
+    return step_ok, embedding_log, binary_path, steps, parse_time_trace(trace_path)
+
+
+def test_program(temp_root: Path, embed: str, source_path: Path) -> dict:
+    """Builds and checks one program in its own build directory (runs in a worker process)"""
+    rel_name = source_path.relative_to(TEST_ROOT).as_posix()
+    build_dir = temp_root / rel_name
+    step_ok, embedding_log, binary_path, steps, pass_timings = build_program(source_path, build_dir, embed)
+    passed, reason = False, "build error"
+    if step_ok:
+        passed, reason, steps["run"] = check_program(source_path, binary_path, args.timeout)
+    return {
+        "rel_name": rel_name,
+        "embedding_log": embedding_log,
+        "binary_path": binary_path,
+        "binary_size": binary_path.stat().st_size if binary_path.exists() else None,
+        "text_size": text_size(binary_path),
+        "passed": passed,
+        "reason": reason,
+        "steps": steps,
+        "pass_timings": pass_timings,
+    }
+
+
+def input_path(source_path: Path):
+    """Programs read <name>.input on stdin if it exists"""
+    path = source_path.with_suffix(".input")
+    return path if path.exists() else None
+
+
+def check_program(source_path: Path, binary_path: Path, timeout: int) -> tuple[bool, str, dict]:
+    """Runs the binary once and compares its output and exit code with the reference output"""
+    expected_output, expected_exit = parse_ref_output(source_path.with_suffix(".reference_output"))
+    stdin = input_path(source_path)
+    with open(stdin or os.devnull, "rb") as stdin_file, tempfile.TemporaryFile() as output:
+        returncode, resources = run_measured(
+            [str(binary_path)], source_path.parent, stdin_file, output, subprocess.DEVNULL, timeout
+        )
+        output.seek(0)
+        actual_output = normalize_output(output.read().decode("utf-8", errors="replace"))
+    if returncode is None:
+        return False, "timeout", resources
+    if actual_output != expected_output:
+        return False, "output differs", resources
+    if returncode != expected_exit:
+        return False, "exit differs", resources
+    return True, "", resources
+
+
+def run_timed(source_path: Path, binary_path: Path):
+    """Runs the binary once with its output discarded.
+    Returns wall time, user time and max RSS (KB) or None if the run failed or timed out."""
+    stdin = input_path(source_path)
+    with open(stdin or os.devnull, "rb") as stdin_file:
+        returncode, resources = run_measured(
+            [str(binary_path)], source_path.parent, stdin_file, subprocess.DEVNULL, subprocess.DEVNULL, args.timeout
+        )
+    if returncode != parse_ref_output(source_path.with_suffix(".reference_output"))[1]:
+        return None
+    return {metric: resources[metric] for metric in BENCHMARK_METRICS}
+
+
+def summarize(samples: list[float]) -> tuple[float, float, float, float]:
+    """Median, median absolute deviation and a distribution-free 95% confidence interval of the median
+    (order statistics, for few samples it widens to the minimum and maximum)"""
+    ordered = sorted(samples)
+    n = len(ordered)
+    median = statistics.median(ordered)
+    mad = statistics.median(abs(value - median) for value in ordered)
+    offset = 1.96 * math.sqrt(n) / 2
+    low = max(1, math.floor(n / 2 - offset))
+    high = min(n, math.ceil(1 + n / 2 + offset))
+    return median, mad, ordered[low - 1], ordered[high - 1]
+
+
+def store_benchmark(conn: sqlite3.Connection, program_measurement_id: int, samples: list[dict]) -> dict:
+    for iteration, sample in enumerate(samples):
+        run_id = conn.execute(
+            "INSERT INTO benchmark_runs (program_measurement_id, iteration, runtime_seconds) VALUES (?, ?, ?)",
+            (program_measurement_id, iteration, sample["wall_seconds"]),
+        ).lastrowid
+        conn.execute(
+            "INSERT INTO benchmark_run_resources (benchmark_run_id, user_seconds, max_rss_kb) VALUES (?, ?, ?)",
+            (run_id, sample["user_seconds"], sample["max_rss_kb"]),
+        )
+    summary = {}
+    for metric in BENCHMARK_METRICS:
+        summary[metric] = summarize([sample[metric] for sample in samples])
+        conn.execute(
+            """
+            INSERT INTO benchmark_statistics (
+                program_measurement_id, metric, repetitions, median, mad, ci_low, ci_high
+            ) VALUES (?, ?, ?, ?, ?, ?, ?)
+            """,
+            (program_measurement_id, metric, len(samples), *summary[metric]),
+        )
+    conn.commit()
+    return summary
+
+
+def format_value(value) -> str:
+    return f"{value:.4g}" if abs(value) < 1000 else f"{value:.0f}"
+
+
+def format_overhead(ratio: float) -> str:
+    return f"{(ratio - 1) * 100:+.1f}%"
+
+
+def print_overhead_report(results: dict) -> None:
+    """Prints the median of every metric of both builds and the overhead of the watermarked one,
+    and the geometric mean of the overheads over all programs"""
+    headers = ["program", *BENCHMARK_METRICS, "binary_size_bytes"]
+    table_rows = []
+    ratios = {header: [] for header in headers[1:]}
+    for rel_name, (baseline, watermarked) in results.items():
+        row = [rel_name]
+        for header in headers[1:]:
+            base = baseline[header] if header == "binary_size_bytes" else baseline[header][0]
+            mark = watermarked[header] if header == "binary_size_bytes" else watermarked[header][0]
+            if not base or not mark:
+                row.append("-")
+                continue
+            ratios[header].append(mark / base)
+            row.append(f"{format_value(base)} -> {format_value(mark)} ({format_overhead(mark / base)})")
+        table_rows.append(row)
+    geomean = ["geomean"]
+    for header in headers[1:]:
+        values = ratios[header]
+        geomean.append(format_overhead(math.exp(sum(map(math.log, values)) / len(values))) if values else "-")
+    table_rows.append(geomean)
+
+    widths = [len(h) for h in headers]
+    for tr in table_rows:
+        for i, value in enumerate(tr):
+            widths[i] = max(widths[i], len(value))
+    print("  ".join(headers[i].ljust(widths[i]) for i in range(len(headers))))
+    print("  ".join("-" * widths[i] for i in range(len(headers))))
+    for tr in table_rows:
+        print("  ".join(tr[i].ljust(widths[i]) for i in range(len(tr))))
+
+
+args = parser.parse_args()
+
+if args.test:
+    db_path = Path(args.store)
+    run_name = args.name or f"{datetime.datetime.now().strftime('%Y%m%d_%H%M%S')}_test"
+    programs = ls_test_programs()
+    args.timeout = args.timeout or 30
+
+    conn = open_database(db_path)
+
+    measurement_id = insert_measurement(conn, run_name, args.embed, True, False, baseline_value(conn))
 
     passed_count = 0
     failed_count = 0
 
     with tempfile.TemporaryDirectory(prefix="softwater-test-run-") as temp_root:
-        temp_root_path = Path(temp_root)
-        for source_path in programs:
-            rel_name = source_path.relative_to(TEST_ROOT).as_posix()
-            ref_path = source_path.with_suffix(".reference_output")
-            expected_output, expected_exit = parse_ref_output(ref_path)
-            build_dir = temp_root_path / source_path.parent.relative_to(TEST_ROOT)
-            build_dir.mkdir(parents=True, exist_ok=True)
-            llvm_path = build_dir / f"{source_path.stem}.ll"
-            binary_path = build_dir / f"{source_path.stem}.out"
-            comp_temp = args.cpp_compiler if source_path.suffix in CXX_EXTENSIONS else args.c_compiler
-            to_llvm_cmd = render_command(
-                comp_temp, {"input": str(source_path), "output": str(llvm_path)}
-            )
-            optimize_cmd = render_command(args.optimize, {"file": str(llvm_path)})
-            embed_cmd = render_command(args.embed, {"file": str(llvm_path)}) if args.embed.strip() else ""
-            comp_cmd = render_command(
-                args.compile, {"input": str(llvm_path), "output": str(binary_path)}
-            )
-            step_ok = True
-            embedding_log = ""
-
-            rc, log = run_shell_command(to_llvm_cmd, cwd=REPO_ROOT)
-            if rc != 0:
-                step_ok = False
-                embedding_log = f"[compile-to-llvm]\n{log}"
-
-            if step_ok:
-                rc, log = run_shell_command(optimize_cmd, cwd=REPO_ROOT)
-                if rc != 0:
-                    step_ok = False
-                    embedding_log = f"[optimize]\n{log}"
-
-            if step_ok and embed_cmd:
-                rc, log = run_shell_command(embed_cmd, cwd=REPO_ROOT)
-                embedding_log = log
-                if rc != 0:
-                    step_ok = False
-                    embedding_log = f"[embed]\n{log}"
-
-            if step_ok:
-                rc, log = run_shell_command(comp_cmd, cwd=REPO_ROOT)
-                if rc != 0:
-                    step_ok = False
-                    if embedding_log:
-                        embedding_log = f"{embedding_log}\n[compile-binary]\n{log}"
-                    else:
-                        embedding_log = f"[compile-binary]\n{log}"
-
-            runtime_ok = False
-            actual_output = ""
-            actual_exit = None
-
-            if step_ok:
-                try:
-                    result = subprocess.run(
-                        [str(binary_path)],
-                        cwd=source_path.parent,
-                        capture_output=True,
-                        text=True,
-                        timeout=30,
-                    )
-                    runtime_ok = True
-                    actual_output = normalize_output(result.stdout)
-                    actual_exit = result.returncode
-                except subprocess.TimeoutExpired as ex:
-                    actual_output = normalize_output((ex.stdout or "") + (ex.stderr or ""))
-                    actual_exit = None
-
-            test_passed = step_ok and runtime_ok and actual_output == expected_output and actual_exit == expected_exit
-
-            watermark_count = parse_wm_count(embedding_log)
-            binary_size = binary_path.stat().st_size if binary_path.exists() else None
-
-            program_id = ensure_program(conn, rel_name)
-            program_measurement_id = conn.execute(
-                """
-                INSERT INTO program_measurements (
-                    measurement_id, program_id, embedding_log, watermarks_added, binary_size_bytes
-                ) VALUES (?, ?, ?, ?, ?)
-                """,
-                (measurement_id, program_id, embedding_log, watermark_count, binary_size),
-            ).lastrowid
-
-            conn.execute(
-                "INSERT INTO test_results (program_measurement_id, passed) VALUES (?, ?)",
-                (program_measurement_id, test_passed),
-            )
-            conn.commit()
-
-            if test_passed:
+        pipeline = functools.partial(test_program, Path(temp_root), args.embed)
+        for index, result in enumerate(run_pipelines(pipeline, programs), 1):
+            insert_program_measurement(conn, measurement_id, result)
+            if index % DB_BATCH_SIZE == 0:
+                conn.commit()
+
+            if result["passed"]:
                 passed_count += 1
-                print(f"PASS {rel_name}")
+                print(f"PASS {result['rel_name']}")
             else:
                 failed_count += 1
-                print(f"FAIL {rel_name}", "output differs" if actual_output != expected_output else ("exit differs" if actual_exit != expected_exit else "build error"))
+                print(f"FAIL {result['rel_name']}", result["reason"])
+        conn.commit()
 
     conn.close()
     print(f"Finished test run '{run_name}': {passed_count} passed, {failed_count} failed, {passed_count + failed_count} total")
-elif args.benchmark:
-    print("Benchmarking is not implemented in this script yet.")
-else:
+
+if args.benchmark:
+    db_path = Path(args.store)
+    run_name = args.name or f"{datetime.datetime.now().strftime('%Y%m%d_%H%M%S')}_bench"
+    programs = ls_test_programs(BENCHMARK_DIRECTORIES)
+    args.timeout = args.timeout or 300
+
+    conn = open_database(db_path)
+
+    # the baseline is built without --embed, the watermarked measurement refers to it
+    args.baseline = None
+    baseline_id = insert_measurement(conn, f"{run_name}_baseline", "", True, True, baseline_value(conn))
+    measurement_id = insert_measurement(conn, run_name, args.embed, True, True, baseline_id)
+    variants = (("baseline", baseline_id, ""), ("watermarked", measurement_id, args.embed))
+
+    results = {}
+    failed_count = 0
+
+    with tempfile.TemporaryDirectory(prefix="softwater-bench-run-") as temp_root:
+        temp_root_path = Path(temp_root)
+        # all builds are done before the first timed run, so they do not disturb the measurement
+        builds = {}
+        for variant, variant_measurement_id, embed in variants:
+            pipeline = functools.partial(test_program, temp_root_path / variant, embed)
+            for source_path, result in zip(programs, run_pipelines(pipeline, programs)):
+                result["program_measurement_id"] = insert_program_measurement(conn, variant_measurement_id, result)
+                builds.setdefault(source_path, []).append((variant, result))
+        conn.commit()
+
+        for source_path in programs:
+            rel_name = source_path.relative_to(TEST_ROOT).as_posix()
+            failed = [f"{variant}: {result['reason']}" for variant, result in builds[source_path] if not result["passed"]]
+            if failed:
+                failed_count += 1
+                print(f"FAIL {rel_name}", ", ".join(failed))
+                continue
+            binaries = [result["binary_path"] for _, result in builds[source_path]]
+
+            for _ in range(args.warmup):
+                for binary_path in binaries:
+                    run_timed(source_path, binary_path)
+
+            # both builds run alternately, so drift of the machine affects them alike
+            samples = [[] for _ in binaries]
+            for _ in range(args.repetitions):
+                for index, binary_path in enumerate(binaries):
+                    sample = run_timed(source_path, binary_path)
+                    if sample:
+                        samples[index].append(sample)
+
+            if any(len(variant_samples) < args.repetitions for variant_samples in samples):
+                failed_count += 1
+                print(f"FAIL {rel_name} run failed or timed out")
+                continue
+
+            summaries = []
+            for (_, result), variant_samples in zip(builds[source_path], samples):
+                summary = store_benchmark(conn, result["program_measurement_id"], variant_samples)
+                summary["binary_size_bytes"] = result["binary_size"]
+                summaries.append(summary)
+            results[rel_name] = summaries
+            baseline_wall, watermarked_wall = (summary["wall_seconds"][0] for summary in summaries)
+            print(f"BENCH {rel_name} {baseline_wall:.3f}s -> {watermarked_wall:.3f}s "
+                  f"({format_overhead(watermarked_wall / baseline_wall)})")
+
+    conn.close()
+    print(f"Finished benchmark run '{run_name}': {len(results)} measured, {failed_count} failed, "
+          f"{args.warmup} warm-up run(s) and {args.repetitions} repetition(s) per build")
+    if results:
+        print()
+        print_overhead_report(results)
+
+if not args.test and not args.benchmark:
     parser.print_help()
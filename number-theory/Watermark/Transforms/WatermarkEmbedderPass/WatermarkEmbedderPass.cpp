@@ -35,7 +35,9 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cassert>
@@ -54,41 +56,91 @@ using namespace llvm;
 using namespace std;
 
 // CLI options for user-provided signature
-static cl::opt<long long> NumberTheorySignature(
+static cl::opt<std::string> NumberTheorySignature(
     "nt-signature",
-    cl::desc("Specify the watermark signature (integer) to embed. If not "
-             "provided, a random signature will be generated."),
-    cl::value_desc("signature"), cl::init(-1));
+    cl::desc("Specify the watermark signature (non-negative integer, up to "
+             "-nt-signature-bits bits) to embed. If not provided, a random "
+             "signature will be generated."),
+    cl::value_desc("signature"), cl::init(""));
+
+static cl::opt<unsigned> NumberTheorySignatureBits(
+    "nt-signature-bits",
+    cl::desc("Capacity of the signature in bits (at most 128): the moduli are "
+             "chosen so that their product is at least 2^bits"),
+    cl::value_desc("bits"), cl::init(64));
+
+static cl::opt<unsigned> NumberTheoryMaxInsertions(
+    "nt-max-insertions",
+    cl::desc("Embed the watermark in at most this many loops (0: all "
+             "suitable loops)"),
+    cl::value_desc("N"), cl::init(10));
 
 static cl::opt<std::string> NumberTheoryKeyFile(
     "nt-keyfile",
     cl::desc("Specify the output path for the watermark key file."),
     cl::value_desc("keyfile"), cl::init("key.txt"));
 
+static cl::opt<bool> NumberTheoryLowOverhead(
+    "nt-low-overhead",
+    cl::desc("Leave the loop bodies untouched and store each watermark part "
+             "once on the exit edge of its loop instead of updating it in "
+             "every iteration"),
+    cl::init(false));
+
+static cl::opt<bool> NumberTheorySideTable(
+    "nt-side-table",
+    cl::desc("Record breakpoint addresses and watermark variables in the "
+             "softwater_nt section instead of relying on debug information, "
+             "so the program does not need to be compiled with -g"),
+    cl::init(false));
+
+static cl::opt<unsigned> NumberTheoryMaxExtractSteps(
+    "nt-max-extract-steps",
+    cl::desc("Choose the iteration of every watermark part among the first K "
+             "iterations of its loop, bounding the breakpoint stops needed "
+             "to extract it (0: up to the trip count)"),
+    cl::value_desc("K"), cl::init(50000));
+
 namespace {
 
 /**
  * @brief Writes key file from the obtained watermark-embedding results
  * @param keys vector of insertion-points <line1, column1, iterations, wm_name,
- * expected_wm_value, function_name>
+ * expected_wm_value, function_name, estimated_extraction_cycles>
  * @param signature the embedded signature S
+ * @param moduli the moduli ni, in the order of keys
  * @param keyFilePath path to the key file
+ * @param sideTable section of the side table if the entries refer to it
+ * (line 0, column = index of the side table entry)
  */
 void createKeyTxt(
-    std::vector<std::tuple<int, int, int, std::string, int, std::string>> keys,
-    long long signature, const std::string &keyFilePath) {
+    std::vector<std::tuple<int, int, int, std::string, long long, std::string,
+                           long long>>
+        keys,
+    Signature signature, const std::vector<long long> &moduli,
+    const std::string &keyFilePath,
+    const std::string &sideTable = "") {
 
   std::ofstream outFile(keyFilePath);
 
   if (outFile.is_open()) {
     // First line: signature
-    outFile << "# signature=" << signature << '\n';
+    outFile << "# signature=" << signatureToString(signature) << '\n';
+    outFile << "# moduli=";
+    for (size_t i = 0; i < moduli.size(); ++i) {
+      outFile << (i ? "," : "") << moduli[i];
+    }
+    outFile << '\n';
+    if (!sideTable.empty()) {
+      outFile << "# side-table=" << sideTable << '\n';
+    }
     // Following lines: breakpoint info (line col iterations var_name
-    // expected_value function_name)
+    // expected_value function_name extraction_cost)
     for (const auto &key : keys) {
       outFile << std::get<0>(key) << ' ' << std::get<1>(key) << ' '
               << std::get<2>(key) << ' ' << std::get<3>(key) << ' '
-              << std::get<4>(key) << ' ' << std::get<5>(key) << '\n';
+              << std::get<4>(key) << ' ' << std::get<5>(key) << ' '
+              << std::get<6>(key) << '\n';
     }
     outFile.close();
     errs() << "Data written to " << keyFilePath << " successfully." << endl
@@ -101,6 +153,7 @@ void createKeyTxt(
 
 /**
  * @brief generate x different random strings of the form "{letter}{digit}"
+ * (with more digits if x exceeds the 260 such strings)
  * @param x amount of strings to generate
  * @return vector of generated strings
  */
@@ -111,10 +164,16 @@ std::vector<std::string> generateRandomStrings(int x) {
   // Seed the random number generator
   std::srand(std::time(0));
 
+  int digits = 1;
+  for (long long names = 260; names < 2 * (long long)x; names *= 10) {
+    ++digits;
+  }
   while (uniqueStrings.size() < x) {
     char letter = 'a' + std::rand() % 26; // Random letter from 'a' to 'z'
-    char digit = '0' + std::rand() % 10;  // Random digit from '0' to '9'
-    std::string str = std::string(1, letter) + digit;
+    std::string str(1, letter);
+    for (int i = 0; i < digits; ++i) {
+      str += '0' + std::rand() % 10; // Random digit from '0' to '9'
+    }
 
     // Insert the string into the set to ensure uniqueness
     if (uniqueStrings.insert(str).second) {
@@ -156,7 +215,8 @@ struct WatermarkEmbedderPass : public PassInfoMixin<WatermarkEmbedderPass> {
     }
 
     // Get suitable Loops (from LoopAnalysis.cpp)
-    map<Loop *, Function *> suitable_loops = getSuitableLoops(M, FAM);
+    vector<SuitableLoop> suitable_loops =
+        getSuitableLoops(M, FAM, !NumberTheorySideTable);
 
     // Check if suitable loops exist else abort
     if (suitable_loops.empty()) {
@@ -164,53 +224,38 @@ struct WatermarkEmbedderPass : public PassInfoMixin<WatermarkEmbedderPass> {
       // End Program with no change to LLVM IR
       return PreservedAnalyses::all();
     } else {
-      printSuitableLoops(suitable_loops, FAM);
+      printSuitableLoops(suitable_loops);
     }
 
-    // Sort Loops first by inner/outer and then seperately by trip ount
-    // ascending Convert map to vector of pairs
-    vector<pair<Loop *, Function *>> sorted_loops(suitable_loops.begin(),
-                                                  suitable_loops.end());
-    // Sort the vector b
-    std::sort(sorted_loops.begin(), sorted_loops.end(),
-              [&](const std::pair<Loop *, Function *> &a,
-                  const std::pair<Loop *, Function *> &b) {
-                bool isOuterA = isOuterLoop(a.first);
-                bool isOuterB = isOuterLoop(b.first);
-                if (isOuterA != isOuterB) {
-                  return isOuterA > isOuterB; // Outer loops first
-                }
-                // Both loops are in the same category (both outer or both
-                // subloops), sort by trip count
-                return getLoopIterations(a.first, a.second, FAM) <
-                       getLoopIterations(b.first, b.second, FAM);
-              });
+    // Rank the loops by the estimated cost of the instrumentation per
+    // program run, cheapest first (the extraction cost breaks ties)
+    vector<LoopCandidate> candidates =
+        rankLoops(M, suitable_loops, FAM, NumberTheoryLowOverhead,
+                  NumberTheoryMaxExtractSteps);
+    if (candidates.empty()) {
+      errs() << "No reachable loop runs! Watermark not embeddable!" << endl;
+      return PreservedAnalyses::all();
+    }
 
     // Calculate number of insertion points
-    int max_insertions = suitable_loops.size();
-    // Set limit of 10 insertion points
-    if (max_insertions > 10) {
-      max_insertions = 10;
+    int max_insertions = candidates.size();
+    // Limit the insertion points (-nt-max-insertions)
+    if (NumberTheoryMaxInsertions > 0 &&
+        (unsigned)max_insertions > NumberTheoryMaxInsertions) {
+      max_insertions = NumberTheoryMaxInsertions;
     }
     errs() << max_insertions << " insertion point(s)" << endl << endl;
-    ;
 
     // Generate Watermark Variables (use user-provided signature if available)
-    Watermark watermark =
-        generateWatermark(max_insertions, NumberTheorySignature);
-
-    // get the first [max_insertions] loops of sorted_loops
-    vector<Loop *> selected_loops;
-    for (int i = 0; i < max_insertions && i < sorted_loops.size(); ++i) {
-      selected_loops.push_back(sorted_loops[i].first);
-    }
-    // Select first [max_insertions] loops as a map
-    map<Loop *, Function *> loops;
-    for (Loop *loop : selected_loops) {
-      auto it = suitable_loops.find(loop);
-      if (it != suitable_loops.end()) {
-        loops.insert(*it);
-      }
+    Watermark watermark = generateWatermark(
+        max_insertions, NumberTheorySignature, NumberTheorySignatureBits);
+
+    // Select the first [max_insertions] (cheapest) loops
+    vector<LoopCandidate> loops(candidates.begin(),
+                                candidates.begin() + max_insertions);
+    double total_cycles = 0;
+    for (const LoopCandidate &candidate : loops) {
+      total_cycles += candidate.cycles;
     }
 
     // generate random variable names of the form {letter}{digit} (e.g. a2, w3,
@@ -223,48 +268,93 @@ struct WatermarkEmbedderPass : public PassInfoMixin<WatermarkEmbedderPass> {
     errs() << endl;
 
     // Insert the watermark parts
-    std::vector<std::tuple<int, int, int, std::string, int, std::string>> keys;
+    double total_extraction = 0;
+    std::vector<
+        std::tuple<int, int, int, std::string, long long, std::string,
+                   long long>>
+        keys;
     int wm_counter = 0;
-    for (const auto &pair : loops) {
-      Loop *loop = pair.first;
-      Function *func = pair.second;
+    // the parts are assigned in the map's order, one per selected loop
+    auto part = watermark.n_to_b.begin();
+    for (const LoopCandidate &candidate : loops) {
+      Loop *loop = candidate.loop;
+      Function *func = candidate.function;
+      TimeTraceScope scope("NumberTheory::insert", func->getName());
 
       string wm_name = wm_names[wm_counter];
 
-      int b = 0;
-      // Check if the wm_counter is within the bounds of the map n_to_b
-      if (wm_counter >= 0 && wm_counter < watermark.n_to_b.size()) {
-        // Use an iterator to access the element at the given position
-        auto it = watermark.n_to_b.begin();
-        std::advance(it, wm_counter);
-
-        // Now 'it' points to the map entry at the desired position
-        b = it->second;
-      } else {
-        std::cout << "Position out of bounds. Couldn't get b." << std::endl;
+      // a loop without a part would embed b = 0 and break the key
+      if (part == watermark.n_to_b.end()) {
+        errs() << "ERROR: Watermark has " << watermark.n_to_b.size()
+               << " part(s) for " << loops.size() << " loop(s).\n";
+        exit(1);
       }
+      long long b = part->second;
+      ++part;
 
       // get total Loop iterations
-      int loop_iterations = getLoopIterations(loop, func, FAM);
-
-      // get iteration of final watermark result/value
-      int iterations = getIntSmallerOrEqual(loop_iterations);
-
-      // Insert Watermark at Insertion Point
-      DILocation *breakpoint_location = insertWMInLoop(
-          b, iterations, loop, *func, FAM, M, wm_counter, wm_name);
+      int loop_iterations = candidate.tripCount;
+
+      // get iteration of final watermark result/value, the low-overhead
+      // mode stores the final value once after the loop
+      int iterations = 1;
+      LoadInst *probe = nullptr;
+      if (NumberTheoryLowOverhead) {
+        probe = insertWMAtLoopExit(b, loop, *func, FAM, M, wm_counter,
+                                   wm_name, NumberTheorySideTable);
+      }
+      if (!probe) {
+        // bounded, so extraction stops at most K times at the breakpoint
+        int bound = loop_iterations;
+        if (NumberTheoryMaxExtractSteps > 0 &&
+            NumberTheoryMaxExtractSteps < (unsigned)bound) {
+          bound = NumberTheoryMaxExtractSteps;
+        }
+        iterations = getIntSmallerOrEqual(bound);
+        // Insert Watermark at Insertion Point
+        probe = insertWMInLoop(b, iterations, loop, *func, FAM, M, wm_counter,
+                               wm_name, NumberTheorySideTable);
+      }
 
-      keys.push_back(std::make_tuple(
-          breakpoint_location->getLine(), breakpoint_location->getColumn(),
-          iterations, wm_name, b, func->getName().str()));
+      long long extraction_cost =
+          candidate.reach * CYCLES_PER_INSTRUCTION +
+          iterations * CYCLES_PER_BREAKPOINT;
+      total_extraction += extraction_cost;
+      if (NumberTheorySideTable) {
+        addSideTableEntry(M, probe, wm_counter, iterations);
+        keys.push_back(std::make_tuple(0, wm_counter, iterations, wm_name, b,
+                                       func->getName().str(),
+                                       extraction_cost));
+      } else {
+        DILocation *breakpoint_location = probe->getDebugLoc();
+        keys.push_back(std::make_tuple(
+            breakpoint_location->getLine(), breakpoint_location->getColumn(),
+            iterations, wm_name, b, func->getName().str(), extraction_cost));
+      }
 
       wm_counter = wm_counter + 1;
     } // END for loop in loops
 
     // write key file
-    createKeyTxt(keys, watermark.S, NumberTheoryKeyFile);
+    vector<long long> moduli;
+    for (auto const &x : watermark.n_to_b) {
+      moduli.push_back(x.first);
+    }
+    createKeyTxt(keys, watermark.S, moduli, NumberTheoryKeyFile,
+                 NumberTheorySideTable ? SIDE_TABLE_SECTION : "");
 
     errs() << "Embedded watermark " << keys.size() << " times.\n";
+    errs() << "Estimated overhead: " << format("%.0f", total_cycles)
+           << " cycles per run\n";
+    errs() << "Estimated extraction cost: "
+           << format("%.0f", total_extraction) << " cycles\n";
+    for (const LoopCandidate &candidate : loops) {
+      errs() << " -> Loop in " << candidate.function->getName() << ": "
+             << format("%.2f", candidate.executions) << " executions x "
+             << candidate.tripCount << " iterations, "
+             << format("%.0f", candidate.cycles) << " cycles, reached after ~"
+             << format("%.0f", candidate.reach) << " instructions\n";
+    }
 
     // changes to the IR -> Analyses are potentially invalidated -> none()
     return PreservedAnalyses::none();
@@ -3,18 +3,27 @@
 // necessary Loop-information A loop is suitable, if its number of iterations is
 // fixed and obtainable
 
+#include "SiteSelection.hpp"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ScalarEvolutionAliasAnalysis.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include <llvm/Transforms/Scalar/LoopRotation.h>
+#include <algorithm>
 #include <map>
+#include <queue>
+#include <vector>
 
 using namespace llvm;
 using namespace std;
@@ -65,27 +74,38 @@ unsigned int getLoopBeginLine(Loop *L) {
   return 0; // Return 0 if loop metadata or debug info is not found.
 }
 
+/**
+ * @brief A loop suitable for watermark insertion, with its cached trip count
+ */
+struct SuitableLoop {
+  Loop *loop;
+  Function *function;
+  unsigned tripCount;
+};
+
 /**
  * @brief Goes through Each loop in the given Module and returns it, if it is
- * suitable for watermark insertion
+ * suitable for watermark insertion. Linear in the size of the module: one
+ * trip count query per loop, loop IDs are deduplicated in a hash set (loops
+ * without an ID are always distinct). The order is reproducible: by function
+ * name, then by position of the loop header in its function.
  * @param M Module
  * @param FAM LLVM's FunctionAnalysisManager
- * @return map of all suitable Loops and thit corresponding Function
+ * @param needsDebugInfo skip functions without debug information (e.g. the
+ * functions other watermarks synthesize), their loops have no location
+ * @return all suitable Loops with their Function and trip count
  */
-map<Loop *, Function *> getSuitableLoops(Module &M,
-                                         FunctionAnalysisManager &FAM) {
+vector<SuitableLoop> getSuitableLoops(Module &M, FunctionAnalysisManager &FAM,
+                                      bool needsDebugInfo) {
+  TimeTraceScope scope("NumberTheory::getSuitableLoops");
 
-  vector<MDNode *> loop_ids;
-  map<Loop *, Function *> suitable_loops;
+  DenseSet<MDNode *> loop_ids;
+  vector<SuitableLoop> suitable_loops;
 
+  vector<Function *> functions;
   for (auto &F : M) {
-    // Disable inlining
-    F.addFnAttr(Attribute::NoInline);
-    F.addFnAttr(Attribute::NoDuplicate);
-
     // Skip Function declarations (printf, rand, etc.)
-    auto isDeclaration = F.isDeclaration();
-    if (isDeclaration) {
+    if (F.isDeclaration()) {
       continue;
     }
 
@@ -95,35 +115,57 @@ map<Loop *, Function *> getSuitableLoops(Module &M,
       continue;
     }
 
-    LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
-
-    if (not LI.empty()) {
-      for (auto &L : LI.getLoopsInPreorder()) {
-        /*
-         Get Trip Count == The number of times the loop iterates before it
-         terminates. The variable that counts iterations is the trip counter.
-         '0' is used to represent an unknown or non-constant trip count.
-         Note that a trip count is simply one more than the backedge taken count
-         for the loop. Calculation of the Trip Count is conservative: if breaks
-         or continues etc. inside of a loop can not be calculated by
-         ScalarEvolution, it will not return the Trip Count.
-        */
-        unsigned int sctc = getLoopIterations(L, &F, FAM);
-        // skip loop if no trip count obtainable
-        if (sctc == 0) {
-          continue;
-        }
-        // Use MDNode for identifying loops that are called multiple times
-        MDNode *loop_id = L->getLoopID();
-        // Count the occurrences of the target value in list_ids
-        int cnt = count(loop_ids.begin(), loop_ids.end(), loop_id);
-        // Only add new loops
-        if (cnt == 0) {
-          loop_ids.push_back(loop_id);
-          suitable_loops[L] = &F;
-        }
-      } // END FOR Loop in LI
-    } // END IF LI.empty()
+    // Skip functions the key file could not refer to
+    if (needsDebugInfo && !F.getSubprogram()) {
+      errs() << "Skipping function " << F.getName()
+             << " (no debug information)\n";
+      continue;
+    }
+    functions.push_back(&F);
+  }
+  std::stable_sort(functions.begin(), functions.end(),
+                   [](const Function *a, const Function *b) {
+                     return a->getName() < b->getName();
+                   });
+
+  for (Function *F : functions) {
+    LoopInfo &LI = FAM.getResult<LoopAnalysis>(*F);
+    if (LI.empty()) {
+      continue;
+    }
+    DenseMap<const BasicBlock *, unsigned> position;
+    for (const BasicBlock &BB : *F) {
+      position[&BB] = position.size();
+    }
+    size_t first = suitable_loops.size();
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      /*
+       Get Trip Count == The number of times the loop iterates before it
+       terminates. The variable that counts iterations is the trip counter.
+       '0' is used to represent an unknown or non-constant trip count.
+       Note that a trip count is simply one more than the backedge taken count
+       for the loop. Calculation of the Trip Count is conservative: if breaks
+       or continues etc. inside of a loop can not be calculated by
+       ScalarEvolution, it will not return the Trip Count.
+      */
+      unsigned int sctc = getLoopIterations(L, F, FAM);
+      // skip loop if no trip count obtainable
+      if (sctc == 0) {
+        continue;
+      }
+      // Use MDNode for identifying loops that are called multiple times
+      MDNode *loop_id = L->getLoopID();
+      // Only add new loops
+      if (loop_id && !loop_ids.insert(loop_id).second) {
+        continue;
+      }
+      suitable_loops.push_back({L, F, sctc});
+    } // END FOR Loop in LI
+    std::sort(suitable_loops.begin() + first, suitable_loops.end(),
+              [&](const SuitableLoop &a, const SuitableLoop &b) {
+                return position[a.loop->getHeader()] <
+                       position[b.loop->getHeader()];
+              });
   } // END FOR F in M
 
   return suitable_loops;
@@ -133,22 +175,255 @@ map<Loop *, Function *> getSuitableLoops(Module &M,
  * @brief Prints all found suitable loops with their corresponding itertions and
  * containing function
  * @param suitable_loops possible loops for watermark insertion
- * @param FAM LLVM's FunctionAnalysisManager
  */
-void printSuitableLoops(map<Loop *, Function *> suitable_loops,
-                        FunctionAnalysisManager &FAM) {
+void printSuitableLoops(const vector<SuitableLoop> &suitable_loops) {
   errs() << suitable_loops.size()
          << " loop(s) found for embedding Watermark:\n";
-  map<Loop *, Function *>::iterator it = suitable_loops.begin();
-  while (it != suitable_loops.end()) {
-    auto &L = it->first;
-    auto &F = it->second;
-    ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(*F);
-    errs() << " -> Loop " << L->getLoopID() << " in Function " << F->getName()
-           << " has " << SE.getSmallConstantTripCount(L) << " iterations\n";
-    ++it;
+  for (const SuitableLoop &suitable : suitable_loops) {
+    errs() << " -> Loop " << suitable.loop->getLoopID() << " in Function "
+           << suitable.function->getName() << " has " << suitable.tripCount
+           << " iterations\n";
   }
   errs() << "\n";
 }
 
+// Estimated cycles the default embedding adds to every iteration: volatile
+// load, add and store in the latch, the reload and the opaque compare-branch
+const double CYCLES_PER_ITERATION = 6;
+// Estimated cycles of the low-overhead embedding per execution of the loop:
+// two loads, two stores and the trip count arithmetic on the exit edge
+const double CYCLES_PER_EXIT = 6;
+// Estimated cycles a breakpoint-driven extractor spends per stop at the
+// watermark location (trap, two context switches, the tracer's bookkeeping)
+const double CYCLES_PER_BREAKPOINT = 20000;
+// Estimated cycles per instruction the program runs before the extractor
+// reaches the loop (about one instruction per cycle)
+const double CYCLES_PER_INSTRUCTION = 1;
+
+/**
+ * @brief A suitable loop with the estimated dynamic cost of embedding a
+ * watermark part into it
+ */
+struct LoopCandidate {
+  Loop *loop;
+  Function *function;
+  unsigned tripCount;
+  // executions of the loop (not of its iterations) per program run
+  double executions;
+  // estimated cycles the instrumentation adds per program run
+  double cycles;
+  // estimated instructions the program executes before it enters the loop
+  double reach;
+  // estimated cycles to extract the part once: running the reach, plus one
+  // breakpoint stop per iteration up to the (expected) target iteration
+  double extraction;
+};
+
+/**
+ * @brief Estimates for every block of F how many instructions of F run
+ * before it is reached the first time: the blocks before it in reverse
+ * post-order, weighted by their frequency per iteration of the outermost loop
+ * they share with it (only the first iteration of that loop runs before the
+ * block). One pass with running sums, overall and per outermost loop.
+ * @param rpo reverse post-order of F's blocks
+ */
+DenseMap<const BasicBlock *, double>
+getPrefixInstructions(const vector<BasicBlock *> &rpo, LoopInfo &LI,
+                      BlockFrequencyInfo &BFI) {
+  DenseMap<const BasicBlock *, double> res;
+  DenseMap<const Loop *, double> inLoop;
+  double total = 0;
+  for (BasicBlock *bb : rpo) {
+    const Loop *outermost = LI.getLoopFor(bb);
+    while (outermost && outermost->getParentLoop())
+      outermost = outermost->getParentLoop();
+    double prefix = total;
+    if (outermost) {
+      double shared = inLoop[outermost];
+      prefix += shared / SiteSelection::relativeFrequency(
+                             BFI, outermost->getHeader()) -
+                shared;
+    }
+    res[bb] = prefix;
+    double weight = SiteSelection::relativeFrequency(BFI, bb) * bb->size();
+    total += weight;
+    if (outermost)
+      inLoop[outermost] += weight;
+  }
+  return res;
+}
+
+/**
+ * @brief Estimated instructions executed before each function is entered
+ * the first time: the cheapest chain of call sites from main (shortest path,
+ * each call site costs the prefix of its block in the caller). Taking a
+ * function's address counts like a call at that point, since it may be
+ * called through the pointer right away. Functions whose address is stored in
+ * a global (function pointer tables, vtables) may be called as soon as main
+ * runs and are seeded with 0, a lower bound. Functions main does not reach
+ * have no entry. Without main every defined function has reach 0.
+ * @param prefixes getPrefixInstructions of every defined function, filled in
+ */
+std::unordered_map<const Function *, double> getFunctionReach(
+    Module &M, FunctionAnalysisManager &FAM,
+    std::unordered_map<const Function *, DenseMap<const BasicBlock *, double>>
+        &prefixes) {
+  std::unordered_map<const Function *, double> reach;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    ReversePostOrderTraversal<Function *> rpot(&F);
+    prefixes[&F] = getPrefixInstructions(
+        vector<BasicBlock *>(rpot.begin(), rpot.end()),
+        FAM.getResult<LoopAnalysis>(F),
+        FAM.getResult<BlockFrequencyAnalysis>(F));
+  }
+  // without main (a library or another translation unit of the program)
+  // every function may be called first, like in estimateEntryCounts
+  Function *main = M.getFunction("main");
+  if (!main || main->isDeclaration()) {
+    for (Function &F : M)
+      if (!F.isDeclaration())
+        reach[&F] = 0;
+    return reach;
+  }
+  using Item = pair<double, Function *>;
+  priority_queue<Item, vector<Item>, greater<Item>> queue;
+  queue.push({0, main});
+  for (Function &F : M) {
+    if (F.isDeclaration() || &F == main)
+      continue;
+    // users outside of instructions (casts aside) are global initializers
+    bool inGlobal = any_of(F.users(), [](const User *user) {
+      if (isa<ConstantExpr>(user))
+        return !all_of(user->users(),
+                       [](const User *use) { return isa<Instruction>(use); });
+      return !isa<Instruction>(user);
+    });
+    if (inGlobal)
+      queue.push({0, &F});
+  }
+  while (!queue.empty()) {
+    auto [distance, F] = queue.top();
+    queue.pop();
+    if (reach.count(F))
+      continue;
+    reach[F] = distance;
+    auto &prefix = prefixes[F];
+    for (BasicBlock &bb : *F) {
+      for (Instruction &I : bb) {
+        // the callee of a call and every function whose address is taken
+        for (Value *operand : I.operands()) {
+          auto *callee = dyn_cast<Function>(operand->stripPointerCasts());
+          if (!callee || callee->isDeclaration() || reach.count(callee))
+            continue;
+          queue.push({distance + prefix.lookup(&bb), callee});
+        }
+      }
+    }
+  }
+  return reach;
+}
+
+/**
+ * @brief Entries of each function per program run: the profile's entry
+ * counts where available (relative to main's), otherwise a static estimate
+ * propagated along the call graph from block frequencies
+ * @param M Module
+ * @param FAM LLVM's FunctionAnalysisManager
+ * @return map of function to estimated entries per run
+ */
+std::unordered_map<const Function *, double>
+getFunctionEntryCounts(Module &M, FunctionAnalysisManager &FAM) {
+  auto counts = SiteSelection::estimateEntryCounts(M, FAM);
+  double runs = 1;
+  if (Function *main = M.getFunction("main"))
+    if (auto mainCount = main->getEntryCount())
+      runs = std::max<double>(1, mainCount->getCount());
+  for (Function &F : M) {
+    if (auto count = F.getEntryCount())
+      counts[&F] = count->getCount() / runs;
+  }
+  return counts;
+}
+
+/**
+ * @brief Scores the suitable loops by the estimated dynamic cost of the
+ * instrumentation per program run (function entries x loop executions per
+ * entry x trip count x cycles per iteration, or per loop execution in
+ * low-overhead mode) and sorts them cheapest first. Every production run pays
+ * this cost, so it alone decides. Ties prefer the cheaper one-off extraction
+ * (the instructions before the loop is first entered, plus a breakpoint stop
+ * per iteration up to the expected target iteration, which is at most
+ * maxExtractSteps), then outer loops and small trip counts. Loops that
+ * never run or whose function main does not reach are dropped, their
+ * part could never be extracted (a module without main keeps them all).
+ * @param M Module
+ * @param suitable_loops possible loops for watermark insertion
+ * @param FAM LLVM's FunctionAnalysisManager
+ * @param lowOverhead whether loops with a unique exit are instrumented on
+ * their exit edge
+ * @param maxExtractSteps bound of the target iteration (0: trip count)
+ * @return candidates sorted by ascending cost, possibly fewer than
+ * suitable_loops
+ */
+vector<LoopCandidate> rankLoops(Module &M,
+                                const vector<SuitableLoop> &suitable_loops,
+                                FunctionAnalysisManager &FAM, bool lowOverhead,
+                                unsigned maxExtractSteps) {
+  TimeTraceScope scope("NumberTheory::rankLoops");
+  auto entryCounts = getFunctionEntryCounts(M, FAM);
+  std::unordered_map<const Function *, DenseMap<const BasicBlock *, double>>
+      prefixes;
+  auto functionReach = getFunctionReach(M, FAM, prefixes);
+  vector<LoopCandidate> candidates;
+  candidates.reserve(suitable_loops.size());
+  unsigned skipped = 0;
+  for (const SuitableLoop &suitable : suitable_loops) {
+    Loop *L = suitable.loop;
+    Function *F = suitable.function;
+    BlockFrequencyInfo &BFI = FAM.getResult<BlockFrequencyAnalysis>(*F);
+    unsigned tripCount = suitable.tripCount;
+    BasicBlock *entering = L->getLoopPreheader();
+    if (!entering)
+      entering = L->getHeader();
+    double executions = entryCounts[F] *
+                        SiteSelection::relativeFrequency(BFI, entering);
+    // a loop that never runs or that main does not reach can't be extracted
+    auto functionIt = functionReach.find(F);
+    if (executions <= 0 || functionIt == functionReach.end()) {
+      skipped++;
+      continue;
+    }
+    bool atExit = lowOverhead && L->getExitBlock();
+    double cycles = atExit ? executions * CYCLES_PER_EXIT
+                           : executions * tripCount * CYCLES_PER_ITERATION;
+    double reach = functionIt->second + prefixes[F].lookup(L->getHeader());
+    // the target iteration is uniform in [1, bound]
+    unsigned bound = maxExtractSteps ? std::min(tripCount, maxExtractSteps)
+                                     : tripCount;
+    double steps = atExit ? 1 : (bound + 1) / 2.0;
+    double extraction =
+        reach * CYCLES_PER_INSTRUCTION + steps * CYCLES_PER_BREAKPOINT;
+    candidates.push_back(
+        {L, F, tripCount, executions, cycles, reach, extraction});
+  }
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const LoopCandidate &a, const LoopCandidate &b) {
+                     if (a.cycles != b.cycles)
+                       return a.cycles < b.cycles;
+                     if (a.extraction != b.extraction)
+                       return a.extraction < b.extraction;
+                     bool isOuterA = isOuterLoop(a.loop);
+                     bool isOuterB = isOuterLoop(b.loop);
+                     if (isOuterA != isOuterB)
+                       return isOuterA > isOuterB;
+                     return a.tripCount < b.tripCount;
+                   });
+  if (skipped)
+    errs() << "Skipped " << skipped
+           << " loop(s) that never run or are not reached from main\n\n";
+  return candidates;
+}
+
 } // END Namespace
@@ -19,7 +19,11 @@
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <random>
 
@@ -54,13 +58,16 @@ Value *getDummyValue(Type *Ty, LLVMContext &Context) {
 }
 
 // Generate an int smaller or equal to i, but greater than 0
-int getIntSmallerOrEqual(int i) {
+long long getIntSmallerOrEqual(long long i) {
   std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<int> dist(1, i);
+  std::mt19937_64 gen(rd());
+  std::uniform_int_distribution<long long> dist(1, i);
   return dist(gen);
 }
 
+// Largest step r, keeps the latch's add an immediate operand on every target
+const long long MAX_STEP = INT32_MAX;
+
 DIScope *getScopeOfInstruction(Instruction *I) {
   // Iterate over instructions in the basic block.
   if (auto DebugLoc = I->getDebugLoc()) {
@@ -90,9 +97,11 @@ DIFile *getDIFileFromScope(DIScope *Scope) {
 /*
  Inserts a int variable at the beginning of a BasicBloc
  Alloc & Store
+ With global, the variable is an internal global instead (its address is
+ known at link time, see addSideTableEntry) and gets no debug information
  */
-Instruction *insertIntVar(int val, int counter, DIBuilder &DIB, Function *F,
-                          std::string name) {
+Value *insertIntVar(long long val, int counter, DIBuilder &DIB, Function *F,
+                    std::string name, bool global = false) {
 
   // Get the first block (entry block) of the function
   BasicBlock &EntryBlockFunc = F->getEntryBlock();
@@ -106,7 +115,17 @@ Instruction *insertIntVar(int val, int counter, DIBuilder &DIB, Function *F,
     }
   }
 
-  Type *intType = Type::getInt32Ty(EntryBlockFunc.getContext());
+  Type *intType = Type::getInt64Ty(EntryBlockFunc.getContext());
+  if (global) {
+    auto *var = new GlobalVariable(*F->getParent(), intType, false,
+                                   GlobalValue::InternalLinkage,
+                                   ConstantInt::get(intType, 0), name);
+    errs() << "Insert Store @" << name << " = " << val
+           << " at function entry" << endl << endl;
+    new StoreInst(ConstantInt::get(intType, val), var, /* isVolatile */ true,
+                  beginFunc);
+    return var;
+  }
   errs() << "Insert alloc %WM" << " before instruction: ";
   beginFunc->print(errs());
   errs() << "\n";
@@ -114,13 +133,14 @@ Instruction *insertIntVar(int val, int counter, DIBuilder &DIB, Function *F,
   auto *allo = new AllocaInst(intType, 0, "", beginFunc);
 
   LLVMContext &Context = F->getContext();
-  DIType *Int32Type = DIB.createBasicType("int", 32, dwarf::DW_ATE_signed);
+  DIType *Int64Type =
+      DIB.createBasicType("long long", 64, dwarf::DW_ATE_signed);
   DILocalVariable *Var =
       DIB.createAutoVariable(F->getSubprogram(),            // Scope
                              name,                          // Variable name
                              F->getSubprogram()->getFile(), // File
                              F->getSubprogram()->getLine(), // Line
-                             Int32Type                      // Type
+                             Int64Type                      // Type
       );
   DILocation *DebugLoc = DILocation::get(Context, F->getSubprogram()->getLine(),
                                          0, F->getSubprogram());
@@ -135,7 +155,7 @@ Instruction *insertIntVar(int val, int counter, DIBuilder &DIB, Function *F,
 
   // Insert store after alloc (volatile to prevent optimization)
   IRBuilder<> builder(&EntryBlockFunc);
-  Value *constant = builder.getInt32(val);
+  Value *constant = builder.getInt64(val);
   errs() << "Insert Store %WM = " << val << " after alloc" << endl << endl;
   auto *store = new StoreInst(constant, allo, /* isVolatile */ true, allo->getNextNode());
 
@@ -145,10 +165,11 @@ Instruction *insertIntVar(int val, int counter, DIBuilder &DIB, Function *F,
 /*
  Insert a Add Instruction of a variable + value before an instruction
  */
-Instruction *insertAdd(Instruction *var, int val, Instruction *I, int counter) {
+Instruction *insertAdd(Value *var, long long val, Instruction *I,
+                       int counter) {
   IRBuilder<> builder(I);
-  Type *intType = Type::getInt32Ty(I->getContext());
-  Value *constant = builder.getInt32(val);
+  Type *intType = Type::getInt64Ty(I->getContext());
+  Value *constant = builder.getInt64(val);
 
   errs() << "Insert Load WM in Latch" << endl;
   auto *load = builder.CreateLoad(intType, var, /* isVolatile */ true, "");
@@ -167,10 +188,11 @@ Instruction *insertAdd(Instruction *var, int val, Instruction *I, int counter) {
 /*
  Insert a Sub Instruction of a variable + value before an instruction
  */
-Instruction *insertSub(Instruction *var, int val, Instruction *I, int counter) {
+Instruction *insertSub(Value *var, long long val, Instruction *I,
+                       int counter) {
   IRBuilder<> builder(I);
-  Type *intType = Type::getInt32Ty(I->getContext());
-  Value *constant = builder.getInt32(val);
+  Type *intType = Type::getInt64Ty(I->getContext());
+  Value *constant = builder.getInt64(val);
 
   errs() << "Insert Load WM in Latch" << endl;
   auto *load = builder.CreateLoad(intType, var, /* isVolatile */ true, "");
@@ -186,14 +208,14 @@ Instruction *insertSub(Instruction *var, int val, Instruction *I, int counter) {
   return store;
 }
 
-int divideWithRoundToLower(int dividend, int divisor) {
+long long divideWithRoundToLower(long long dividend, long long divisor) {
   if (divisor == 0) {
     std::cerr << "Error: Division by zero" << std::endl;
     return 0;
   }
 
   // Calculate the division result
-  int result = dividend / divisor;
+  long long result = dividend / divisor;
 
   // If the result is negative and there's a remainder, decrement the result by
   // 1
@@ -203,22 +225,73 @@ int divideWithRoundToLower(int dividend, int divisor) {
   return result;
 }
 
+/*
+ Find a debug location from inside the loop body that hits on every iteration.
+ We look for an instruction inside the loop that has a debug location
+ pointing to a line INSIDE the loop body (not the for statement line).
+ Returns nullptr if the loop has no debug locations at all.
+ */
+DILocation *getLoopLocation(Loop *L) {
+  DILocation *loop_location = nullptr;
+  DILocation *fallback_location = nullptr;
+
+  // First, try to find an instruction in the loop body with a debug location
+  for (BasicBlock *BB : L->getBlocks()) {
+    for (Instruction &I : *BB) {
+      if (auto DL = I.getDebugLoc()) {
+        if (!fallback_location) {
+          fallback_location = DL.get();
+        }
+        // Skip PHI nodes and terminators - we want actual loop body instructions
+        if (!isa<PHINode>(&I) && !I.isTerminator()) {
+          loop_location = DL.get();
+          break;
+        }
+      }
+    }
+    if (loop_location) break;
+  }
+
+  // Fall back to the latch branch location if nothing else found
+  if (!loop_location) {
+    auto latch = L->getLoopLatch();
+    Instruction *LastInst = &latch->back();
+    if (BranchInst *Branch = dyn_cast<BranchInst>(LastInst)) {
+      loop_location = Branch->getDebugLoc();
+    }
+  }
+
+  if (!loop_location) {
+    loop_location = fallback_location;
+  }
+
+  return loop_location;
+}
+
+// First column of the breakpoint locations, far beyond any real column, so
+// no other instruction shares them. Copies of a probe made by unrolling or
+// peeling an enclosing loop keep its location and still count one hit per
+// execution of the original probe.
+const unsigned PROBE_COLUMN = 4000;
+
 // Handles the process of adding the watermark into the loop
 // Insertion of Variable (Preheader)
 // Insertion of erithmetic (Latch)
 // Insertion of debugging information
 // Insertion of opaque predicate
-DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
-                           FunctionAnalysisManager &FAM, Module &M, int counter,
-                           std::string var_name) {
+// Returns the load the watermark is read at (the breakpoint), with
+// side_table the variable is global and debug information is optional
+LoadInst *insertWMInLoop(long long b, int iteration, Loop *L, Function &F,
+                         FunctionAnalysisManager &FAM, Module &M, int counter,
+                         std::string var_name, bool side_table) {
 
   errs() << "INSERTION:" << endl;
   errs() << "---------------------------" << endl;
   errs() << "b=" << b << " in loop: " << L->getLoopID() << " at the "
          << iteration << "th iteration" << endl;
 
-  int r = 0;
-  int x0 = 0;
+  long long r = 0;
+  long long x0 = 0;
   bool add_method = true;
   // if b < k: r can be randomly big, lets say <= 94
   if (b < iteration) {
@@ -229,8 +302,8 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
     errs() << "Start value = " << x0 << endl;
   } else {
     errs() << "Method: +=  :  ";
-    int x = divideWithRoundToLower(b, iteration);
-    r = getIntSmallerOrEqual(x);
+    long long x = divideWithRoundToLower(b, iteration);
+    r = getIntSmallerOrEqual(std::min(x, MAX_STEP));
     // Select r such that r * iterations <= b
     x0 = b - (r * iteration);
     errs() << "Start value = " << x0 << endl;
@@ -246,6 +319,10 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
       MDString::get(C, "llvm.loop.vectorize.enable"),
       ConstantAsMetadata::get(ConstantInt::get(Type::getInt1Ty(C), 0))};
   MDNode *DisableVectorizeNode = MDNode::get(C, DisableVectorizeMD);
+  // Unrolling would multiply the latch arithmetic and the breakpoint
+  // location, so only this loop opts out instead of NoDuplicate everywhere
+  MDNode *DisableUnrollNode =
+      MDNode::get(C, MDString::get(C, "llvm.loop.unroll.disable"));
   // Get existing loop metadata
   MDNode *LoopID = L->getLoopID();
   SmallVector<Metadata *, 4> MDs;
@@ -258,6 +335,7 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   }
   // Add the new metadata to the list
   MDs.push_back(DisableVectorizeNode);
+  MDs.push_back(DisableUnrollNode);
   // Create the new LoopID with the new metadata
   MDNode *NewLoopID = MDNode::get(C, MDs);
   L->setLoopID(NewLoopID);
@@ -267,50 +345,16 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   // Get Loop Predecessor
   static LLVMContext Context;
 
-  // Find a debug location from inside the loop body that hits on every iteration
-  // We look for an instruction inside the loop that has a debug location
-  // pointing to a line INSIDE the loop body (not the for statement line)
-  DILocation *loop_location = nullptr;
-  DILocation *fallback_location = nullptr;
-
-  // First, try to find an instruction in the loop body with a debug location
-  for (BasicBlock *BB : L->getBlocks()) {
-    for (Instruction &I : *BB) {
-      if (auto DL = I.getDebugLoc()) {
-        if (!fallback_location) {
-          fallback_location = DL.get();
-        }
-        // Skip PHI nodes and terminators - we want actual loop body instructions
-        if (!isa<PHINode>(&I) && !I.isTerminator()) {
-          loop_location = DL.get();
-          break;
-        }
-      }
-    }
-    if (loop_location) break;
-  }
-
-  // Fall back to the latch branch location if nothing else found
-  if (!loop_location) {
-    auto latch = L->getLoopLatch();
-    Instruction *LastInst = &latch->back();
-    if (BranchInst *Branch = dyn_cast<BranchInst>(LastInst)) {
-      loop_location = Branch->getDebugLoc();
-    }
-  }
-
-  if (!loop_location) {
-    loop_location = fallback_location;
-  }
-
-  if (!loop_location) {
+  DILocation *loop_location = getLoopLocation(L);
+  if (!loop_location && !side_table) {
     errs() << "ERROR: Could not find debug location for loop. "
-           << "Ensure code is compiled with -g flag.\n";
+           << "Ensure code is compiled with -g flag or use -nt-side-table.\n";
     exit(1);
   }
-
-  errs() << "Using Loop location: line " << loop_location->getLine()
-         << ", col " << loop_location->getColumn() << endl;
+  if (loop_location) {
+    errs() << "Using Loop location: line " << loop_location->getLine()
+           << ", col " << loop_location->getColumn() << endl;
+  }
 
   auto latch = L->getLoopLatch();
 
@@ -319,7 +363,8 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   ParentFunction->addFnAttr(Attribute::NoInline);
   
   DIBuilder DIB(M);
-  Instruction *allo = insertIntVar(x0, counter, DIB, ParentFunction, var_name);
+  Value *allo =
+      insertIntVar(x0, counter, DIB, ParentFunction, var_name, side_table);
 
   // Insert bi calculation instructions in loop latch/body
   Instruction *store = 0;
@@ -343,22 +388,28 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   // This ensures the breakpoint is set where the watermark variable is accessible
   DILocation *key_file_location = nullptr;
   
-  // First, try to get debug location from the latch terminator (branch back to header)
+  // First, try to get debug location from the latch terminator (branch back to
+  // header), with a column of its own so the branch does not share it
   if (Instruction *term = latch->getTerminator()) {
     if (DILocation *loc = term->getDebugLoc()) {
-      key_file_location = loc;
+      key_file_location = DILocation::get(
+          F.getContext(), loc->getLine(), PROBE_COLUMN + counter,
+          loc->getScope(), loc->getInlinedAt());
     }
   }
   
   // Fallback: use the function's starting location to ensure we're in the right scope
-  if (!key_file_location) {
+  if (!key_file_location && ParentFunction->getSubprogram()) {
     key_file_location = DILocation::get(F.getContext(),
                                         ParentFunction->getSubprogram()->getLine(),
-                                        0, ParentFunction->getSubprogram());
+                                        PROBE_COLUMN + counter,
+                                        ParentFunction->getSubprogram());
   }
   
-  errs() << "Using key file location: line " << key_file_location->getLine()
-         << ", col " << key_file_location->getColumn() << endl;
+  if (key_file_location) {
+    errs() << "Using key file location: line " << key_file_location->getLine()
+           << ", col " << key_file_location->getColumn() << endl;
+  }
 
   errs() << "Create Opaque Predicate..." << endl;
 
@@ -366,7 +417,7 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   LLVMContext &context = F.getContext();
   IRBuilder<> builder(context);
   builder.SetInsertPoint(store->getNextNonDebugInstruction());
-  Type *intType = Type::getInt32Ty(context);
+  Type *intType = Type::getInt64Ty(context);
   auto *load = builder.CreateLoad(intType, allo, /* isVolatile */ true, "");
   errs() << "Insert load after store" << endl;
 
@@ -389,14 +440,17 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   if (add_method) {
     // += -> b never gets smaller than starting value x0
     cmp = builder_bb.CreateICmpEQ(
-        load, ConstantInt::get(Type::getInt32Ty(context), (x0 - 1)));
+        load, ConstantInt::get(Type::getInt64Ty(context), (x0 - 1)));
   } else {
     // -= -> b never gets bigger than starting value x0
     cmp = builder_bb.CreateICmpEQ(
-        load, ConstantInt::get(Type::getInt32Ty(context), (x0 + 1)));
+        load, ConstantInt::get(Type::getInt64Ty(context), (x0 + 1)));
   }
 
-  builder_bb.CreateCondBr(cmp, newBB, continueBB);
+  // the opaque block is never executed
+  builder_bb.CreateCondBr(
+      cmp, newBB, continueBB,
+      MDBuilder(context).createBranchWeights(1, (1 << 20) - 1));
 
   // auto *cnd = builder_bb.CreateCondBr(cmp, newBB, continueBB);
   // cnd->setDebugLoc(Loc);
@@ -409,7 +463,6 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   errs() << "Branch instruction: ";
   br->print(errs());
   errs() << endl;
-  errs() << "Line: " << br->getDebugLoc()->getLine() << endl;
 
   // update ALL phi nodes of loop-latch to contain the newly added block
   for (auto &I : *parentBB) {
@@ -437,7 +490,6 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
     errs() << "*Branch instruction: ";
     lastBrInst.print(errs());
     errs() << endl;
-    errs() << "*Line: " << lastBrInst.getDebugLoc()->getLine() << endl;
   } else {
     errs() << "The last instruction is not a branch instruction.\n";
   }
@@ -466,7 +518,167 @@ DILocation *insertWMInLoop(int b, int iteration, Loop *L, Function &F,
   */
 
   errs() << "---------------------------" << endl << endl;
-  return key_file_location;
+  return load;
 
 } // END insertWMInLoop
+
+// Number of header executions of L, computed on the edge to exitBlock from
+// the live-out of an induction variable with a constant step: its latch value
+// if L exits from its latch, otherwise the header phi (one execution less).
+// Returns nullptr if L has no such induction variable or exitBlock is not
+// dedicated to the exiting block.
+Value *getTripCountFromInduction(Loop *L, BasicBlock *exitBlock,
+                                 ScalarEvolution &SE, IRBuilder<> &builder) {
+  BasicBlock *exiting = L->getExitingBlock();
+  BasicBlock *latch = L->getLoopLatch();
+  if (!exiting || !latch || exitBlock->getSinglePredecessor() != exiting ||
+      (exiting != latch && exiting != L->getHeader()))
+    return nullptr;
+  for (PHINode &phi : L->getHeader()->phis()) {
+    auto *rec = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&phi));
+    if (!phi.getType()->isIntegerTy() || phi.getNumIncomingValues() != 2 ||
+        !rec || rec->getLoop() != L || !rec->isAffine())
+      continue;
+    auto *step = dyn_cast<SCEVConstant>(rec->getStepRecurrence(SE));
+    if (!step || step->getValue()->isZero())
+      continue;
+    Value *start = phi.getIncomingValue(phi.getIncomingBlock(0) == latch);
+    Value *live = exiting == latch ? phi.getIncomingValueForBlock(latch)
+                                   : (Value *)&phi;
+    Value *n = builder.CreateSDiv(builder.CreateSub(live, start),
+                                  step->getValue(), "", /* isExact */ true);
+    if (live == &phi)
+      n = builder.CreateAdd(n, ConstantInt::get(n->getType(), 1));
+    return builder.CreateSExtOrTrunc(n, builder.getInt64Ty());
+  }
+  return nullptr;
+}
+
+// Low-overhead variant of insertWMInLoop that leaves the loop body untouched
+// (no volatile traffic, no extra branch, no vectorizer veto):
+// The watermark variable follows in closed form from the trip count n of the
+// loop, x = x0 +/- r * n = b, and is only materialized once on the loop's
+// exit edge. x0 is read back from the variable and n comes from an induction
+// variable, so the optimizer cannot fold x into the constant b. The variable
+// is reset to x0 after the probe for the next execution of the loop. A
+// volatile load right after the store carries a debug location of its own,
+// the breakpoint hits it once per execution of the loop, so the key's
+// iteration is 1.
+// Returns the load, or nullptr without changing anything if the loop has no
+// unique exit block or no computable trip count.
+LoadInst *insertWMAtLoopExit(long long b, Loop *L, Function &F,
+                             FunctionAnalysisManager &FAM, Module &M,
+                             int counter, std::string var_name,
+                             bool side_table) {
+  BasicBlock *exitBlock = L->getExitBlock();
+  ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+  const SCEV *btc = SE.getBackedgeTakenCount(L);
+  int n = SE.getSmallConstantTripCount(L);
+  if (!exitBlock || isa<SCEVCouldNotCompute>(btc) || n == 0)
+    return nullptr;
+
+  errs() << "INSERTION (low overhead):" << endl;
+  errs() << "---------------------------" << endl;
+  errs() << "b=" << b << " at the exit of loop: " << L->getLoopID() << endl;
+
+  // same choice of x0 and r as insertWMInLoop for the n-th iteration
+  long long r = 0;
+  long long x0 = 0;
+  bool add_method = b >= n;
+  if (!add_method) {
+    r = getIntSmallerOrEqual(100);
+    x0 = b + (r * n);
+  } else {
+    r = getIntSmallerOrEqual(
+        std::min(divideWithRoundToLower(b, n), MAX_STEP));
+    x0 = b - (r * n);
+  }
+  errs() << "Start value = " << x0 << ", step = " << r << endl;
+
+  DILocation *loop_location = getLoopLocation(L);
+  if (!loop_location && !side_table) {
+    errs() << "ERROR: Could not find debug location for loop. "
+           << "Ensure code is compiled with -g flag or use -nt-side-table.\n";
+    exit(1);
+  }
+  F.addFnAttr(Attribute::NoInline);
+  DIBuilder DIB(M);
+  Value *allo = insertIntVar(x0, counter, DIB, &F, var_name, side_table);
+
+  // x = x0 +/- r * n, n = backedge-taken count + 1
+  LLVMContext &context = F.getContext();
+  Type *intType = Type::getInt64Ty(context);
+  Instruction *insertPt = &*exitBlock->getFirstInsertionPt();
+  IRBuilder<> builder(insertPt);
+  Value *tripCount = getTripCountFromInduction(L, exitBlock, SE, builder);
+  if (!tripCount) {
+    SCEVExpander expander(SE, M.getDataLayout(), "wm");
+    tripCount = expander.expandCodeFor(
+        SE.getTruncateOrZeroExtend(
+            SE.getAddExpr(btc, SE.getOne(btc->getType())), intType),
+        intType, insertPt);
+  }
+  Value *start = builder.CreateLoad(intType, allo, /* isVolatile */ true);
+  Value *step = builder.CreateMul(ConstantInt::get(intType, r), tripCount);
+  Value *x = add_method ? builder.CreateAdd(start, step)
+                        : builder.CreateSub(start, step);
+  auto *store = builder.CreateStore(x, allo, /* isVolatile */ true);
+  store->setDebugLoc(loop_location);
+  auto *load = builder.CreateLoad(intType, allo, /* isVolatile */ true, "");
+  builder.CreateStore(ConstantInt::get(intType, x0), allo,
+                      /* isVolatile */ true)
+      ->setDebugLoc(loop_location);
+  if (loop_location) {
+    DILocation *key_location = DILocation::get(
+        context, loop_location->getLine(), PROBE_COLUMN + counter,
+        loop_location->getScope(), loop_location->getInlinedAt());
+    load->setDebugLoc(key_location);
+    errs() << "Using key file location: line " << key_location->getLine()
+           << ", col " << key_location->getColumn() << endl;
+  }
+  errs() << "---------------------------" << endl << endl;
+  return load;
+} // END insertWMAtLoopExit
+
+// Section of the side table written by addSideTableEntry
+const char *SIDE_TABLE_SECTION = "softwater_nt";
+
+// Records everything the extraction needs for one watermark part, so the
+// program can be built without -g: a { i32 pc, i32 variable, i32 index,
+// i32 iteration } entry in SIDE_TABLE_SECTION. pc (the address of a block
+// starting at the probe load, i.e. the breakpoint) and variable (the global
+// watermark variable) are relative to the entry itself, so the table needs no
+// dynamic relocations and stays valid in position independent executables.
+// Taking the block's address also keeps later passes from merging it away.
+void addSideTableEntry(Module &M, LoadInst *probe, int counter,
+                       int iteration) {
+  BasicBlock *probeBB = probe->getParent();
+  if (&probeBB->front() != probe) {
+    probeBB = probeBB->splitBasicBlock(probe, "");
+  }
+  LLVMContext &context = M.getContext();
+  Type *intType = Type::getInt32Ty(context);
+  Type *ptrIntType = M.getDataLayout().getIntPtrType(context);
+  StructType *entryType =
+      StructType::get(intType, intType, intType, intType);
+  auto *entry = new GlobalVariable(M, entryType, /* isConstant */ true,
+                                   GlobalValue::InternalLinkage, nullptr,
+                                   "watermark_nt_entry");
+  auto relative = [&](Constant *target) {
+    return ConstantExpr::getTrunc(
+        ConstantExpr::getSub(ConstantExpr::getPtrToInt(target, ptrIntType),
+                             ConstantExpr::getPtrToInt(entry, ptrIntType)),
+        intType);
+  };
+  Constant *var = cast<Constant>(probe->getPointerOperand());
+  entry->setInitializer(ConstantStruct::get(
+      entryType, {relative(BlockAddress::get(probeBB->getParent(), probeBB)),
+                  relative(var), ConstantInt::get(intType, counter),
+                  ConstantInt::get(intType, iteration)}));
+  entry->setSection(SIDE_TABLE_SECTION);
+  entry->setAlignment(Align(4));
+  appendToUsed(M, {entry});
+  errs() << "Side table entry " << counter << ": iteration " << iteration
+         << endl;
+}
 } // namespace
@@ -3,6 +3,9 @@
 
 #include <cassert>
 #include <climits>
+#include <cmath>
+#include <cstdint>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/raw_ostream.h>
 #include <map>
 #include <random>
@@ -12,24 +15,60 @@ using namespace std;
 
 namespace {
 
+// Signature type, wide enough for -nt-signature-bits=128
+typedef unsigned __int128 Signature;
+
+// Largest modulus, the residues b (and the watermark variable's start value
+// x0 = b + r * iteration) stay within a signed 64 bit integer
+const unsigned MAX_MODULUS_BITS = 62;
+
 struct Watermark {
-  int S;
-  int N;
-  std::map<int, int> n_to_b;
+  Signature S;
+  // log2 of N, the product of the moduli (N itself may not fit 128 bits)
+  double capacity;
+  std::map<long long, long long> n_to_b;
 };
 
+/**
+ * @brief decimal representation of a signature
+ */
+std::string signatureToString(Signature s) {
+  std::string res;
+  do {
+    res.insert(res.begin(), '0' + (char)(s % 10));
+    s /= 10;
+  } while (s);
+  return res;
+}
+
+/**
+ * @brief parses a decimal signature
+ * @return false if str is no (non-negative) decimal number
+ */
+bool parseSignature(const std::string &str, Signature &s) {
+  if (str.empty() || str.size() > 39)
+    return false;
+  s = 0;
+  for (char c : str) {
+    if (c < '0' || c > '9')
+      return false;
+    s = s * 10 + (c - '0');
+  }
+  return true;
+}
+
 /**
  * @brief prints the entire watermark
  * @param wm Watermark with its calculated parts
  */
 void printWatermark(Watermark wm) {
   errs() << "---------------------------\n";
-  errs() << "N: " << wm.N << "\n";
-  errs() << "S: " << wm.S << "\n";
+  errs() << "N: ~2^" << format("%.1f", wm.capacity) << "\n";
+  errs() << "S: " << signatureToString(wm.S) << "\n";
   int count = 0;
   for (auto const &x : wm.n_to_b) {
-    int n = x.first;
-    int b = x.second;
+    long long n = x.first;
+    long long b = x.second;
     errs() << "(n" << count << "=" << n << " | b" << count << "=" << b << "), ";
     ++count;
   }
@@ -37,32 +76,66 @@ void printWatermark(Watermark wm) {
   errs() << "---------------------------" << "\n" << "\n";
 }
 
+// a * b mod m without overflow
+uint64_t mulMod(uint64_t a, uint64_t b, uint64_t m) {
+  return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+uint64_t powMod(uint64_t base, uint64_t exp, uint64_t m) {
+  uint64_t res = 1;
+  base %= m;
+  while (exp) {
+    if (exp & 1)
+      res = mulMod(res, base, m);
+    base = mulMod(base, base, m);
+    exp >>= 1;
+  }
+  return res;
+}
+
 /**
- * @brief check if a number is prime
+ * @brief check if a number is prime (deterministic Miller-Rabin, the bases
+ * cover all 64 bit numbers)
  * @param num Number to check for prime
  */
-bool isPrime(int num) {
-  if (num <= 1)
-    return false;
-  if (num <= 3)
-    return true;
-  if (num % 2 == 0 || num % 3 == 0)
+bool isPrime(uint64_t num) {
+  if (num < 2)
     return false;
-  for (int i = 5; i <= std::sqrt(num); i += 6) {
-    if (num % i == 0 || num % (i + 2) == 0)
+  const uint64_t bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+  for (uint64_t p : bases) {
+    if (num % p == 0)
+      return num == p;
+  }
+  uint64_t d = num - 1;
+  unsigned s = 0;
+  while (d % 2 == 0) {
+    d /= 2;
+    ++s;
+  }
+  for (uint64_t a : bases) {
+    uint64_t x = powMod(a, d, num);
+    if (x == 1 || x == num - 1)
+      continue;
+    bool composite = true;
+    for (unsigned i = 1; i < s && composite; ++i) {
+      x = mulMod(x, x, num);
+      composite = x != num - 1;
+    }
+    if (composite)
       return false;
   }
   return true;
 }
 
 /**
- * @brief generates the first x prime numbers
+ * @brief generates the first x prime numbers that are at least min
  * @param x Number of primes to generate
- * @return vector of first x prime numbers
+ * @param min lower bound of the primes
+ * @return vector of x ascending primes
  */
-std::vector<int> generatePrimes(int x) {
-  std::vector<int> primes;
-  int num = 2; // Start with the first prime number
+std::vector<long long> generatePrimes(int x, uint64_t min = 2) {
+  std::vector<long long> primes;
+  uint64_t num = std::max<uint64_t>(min, 2);
   while (primes.size() < x) {
     if (isPrime(num)) {
       primes.push_back(num);
@@ -72,6 +145,19 @@ std::vector<int> generatePrimes(int x) {
   return primes;
 }
 
+/**
+ * @brief chooses x pairwise coprime moduli (distinct primes) whose product
+ * is at least 2^bits: the smallest primes >= 2^(bits / x), so fewer parts
+ * get larger moduli
+ * @param x Number of moduli
+ * @param bits capacity in bits, at most x * MAX_MODULUS_BITS
+ * @return vector of x ascending moduli
+ */
+std::vector<long long> generateModuli(int x, unsigned bits) {
+  long double min = std::ceil(std::pow(2.0L, (long double)bits / x));
+  return generatePrimes(x, (uint64_t)min);
+}
+
 /*
 bool isPrime(int n) {
     // Since 0 and 1 is not
@@ -120,53 +206,73 @@ Prime numbers generated for number of insertion points / loops." << "\n";
 /**
  * @brief process for generating a CRT watermark: ni, S, bi (S modulo ni = bi)
  * @param loop_count number of loops -> number of watermark parts ni
- * @param user_signature optional user-provided signature (-1 means generate randomly)
+ * @param user_signature optional user-provided signature (decimal, empty or
+ * negative means generate randomly)
+ * @param bits signature capacity in bits (up to 128), limited to
+ * loop_count * MAX_MODULUS_BITS; a user-provided signature that does not fit
+ * aborts, a random one is drawn within the capacity
  * @return calculated Watermark
  */
-Watermark generateWatermark(int loop_count, long long user_signature = -1) {
+Watermark generateWatermark(int loop_count,
+                            const std::string &user_signature = "",
+                            unsigned bits = 64) {
   errs() << "Generate Watermark:" << "\n";
 
-  vector<int> ni = generatePrimes(loop_count);
+  bits = std::min(bits, 128u);
+  if (bits > loop_count * MAX_MODULUS_BITS) {
+    bits = loop_count * MAX_MODULUS_BITS;
+    errs() << "WARNING: " << loop_count << " insertion point(s) only hold a "
+           << bits << " bit signature.\n";
+  }
+  vector<long long> ni = generateModuli(loop_count, bits);
 
-  // Get Product(ni) = N
-  unsigned long N = 1;
-  for (int n : ni) {
-    N *= n;
+  // log2(Product(ni)) = log2(N)
+  double capacity = 0;
+  for (long long n : ni) {
+    capacity += std::log2((double)n);
   }
-  errs() << "Generated primes, N = " << N << "\n";
+  errs() << "Generated moduli, N = ~2^" << format("%.1f", capacity) << "\n";
+
+  // every S < 2^bits <= N can be embedded
+  Signature limit = bits == 128 ? ~(Signature)0 : ((Signature)1 << bits) - 1;
 
   // Select S: use user-provided or generate randomly
-  long long S;
-  if (user_signature >= 0) {
-    // User provided signature - validate it fits
-    if ((unsigned long long)user_signature >= N) {
-      errs() << "WARNING: Provided signature " << user_signature
-             << " is >= N (" << N << "). Using S = signature mod N.\n";
-      S = user_signature % N;
-    } else {
-      S = user_signature;
+  Signature S;
+  if (!user_signature.empty() && user_signature[0] != '-') {
+    if (!parseSignature(user_signature, S)) {
+      errs() << "ABORT: Invalid signature " << user_signature << "\n";
+      exit(1);
     }
-    errs() << "Using user-provided signature S = " << S << "\n";
+    // User provided signature - embedding another one would be worthless
+    if (S > limit) {
+      errs() << "ABORT: Provided signature " << user_signature
+             << " does not fit " << bits << " bits (" << loop_count
+             << " insertion point(s), -nt-signature-bits).\n";
+      exit(1);
+    }
+    errs() << "Using user-provided signature S = " << signatureToString(S)
+           << "\n";
   } else {
     // Generate random signature
     std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<long> dist(1, N - 1);
-    S = dist(gen) % INT_MAX;
-    errs() << "Generated random signature S = " << S << "\n";
+    std::mt19937_64 gen(rd());
+    do {
+      S = ((Signature)gen() << 64 | gen()) & limit;
+    } while (S == 0);
+    errs() << "Generated random signature S = " << signatureToString(S)
+           << "\n";
   }
 
   // calc bi for each ni
-  map<int, int> n_to_b;
-  for (int n : ni) {
-    int b = S % n;
-    n_to_b[n] = b;
+  map<long long, long long> n_to_b;
+  for (long long n : ni) {
+    n_to_b[n] = (long long)(S % (Signature)n);
   }
   errs() << "Generated n_to_b" << "\n";
 
   Watermark watermark;
   watermark.S = S;
-  watermark.N = N;
+  watermark.capacity = capacity;
   watermark.n_to_b = n_to_b;
   errs() << "Generated watermark" << "\n";
   printWatermark(watermark);
@@ -0,0 +1,18 @@
+# execute in Tests directory
+# Compares the run time of almabench for an unpatched build, the default
+# Number-Theory embedding and -nt-low-overhead. almabench.ll has no debug
+# info, debugify adds synthetic locations so the pass can place its key.
+OUT=$(mktemp -d)
+PLUGIN=-load-pass-plugin=./build/number-theory/libNumberTheory.so
+opt -passes=debugify almabench.ll -o $OUT/alma.ll -S
+opt $PLUGIN -passes=wm-embedder $OUT/alma.ll -o $OUT/default.ll -S -nt-signature=42 -nt-keyfile=$OUT/default.key
+opt $PLUGIN -passes=wm-embedder $OUT/alma.ll -o $OUT/low.ll -S -nt-signature=42 -nt-keyfile=$OUT/low.key -nt-low-overhead
+for variant in alma default low; do
+  clang -O2 $OUT/$variant.ll -o $OUT/$variant -lm
+done
+for variant in alma default low; do
+  echo -n "$variant: "
+  # almabench reads TEST_LOOPS and TEST_LENGTH from stdin
+  printf '20\n36525\n' | /usr/bin/time -f "%e s" $OUT/$variant > /dev/null
+done
+rm -rf $OUT
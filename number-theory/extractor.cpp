@@ -0,0 +1,1089 @@
+/**
+ * Native Number-Theory extractor: runs the watermarked program once under
+ * ptrace with a breakpoint on every key location, counts the hits in the
+ * tracer and reads each watermark variable from its DWARF location at the
+ * hit given in the key. Replaces the per-entry lldb sessions of extractor.py
+ * (same key format and report), x86-64 Linux only.
+ *
+ * With --static the program is not run at all: the initial value x0 and the
+ * per-iteration step r the embedder wrote next to the variable are read from
+ * the disassembled function and the value at iteration k is x0 + r * k.
+ *
+ * usage: nt-extractor <program> <key file> [--static] [--input <string>]
+ *        [--input-file <file>] [--verbose] [-- <program arguments>...]
+ */
+#include <llvm/DebugInfo/DWARF/DWARFContext.h>
+#include <llvm/DebugInfo/DWARF/DWARFDebugFrame.h>
+#include <llvm/DebugInfo/DWARF/DWARFDebugLine.h>
+#include <llvm/DebugInfo/DWARF/DWARFDie.h>
+#include <llvm/MC/MCAsmInfo.h>
+#include <llvm/MC/MCContext.h>
+#include <llvm/MC/MCDisassembler/MCDisassembler.h>
+#include <llvm/MC/MCInst.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/MCTargetOptions.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Object/ELFObjectFile.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/LEB128.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+using namespace llvm;
+
+#define RED "\033[91m"
+#define GREEN "\033[92m"
+#define BLUE "\033[94m"
+#define RESET "\033[0m"
+
+// signatures have up to 128 bits (-nt-signature-bits)
+typedef unsigned __int128 Signature;
+
+static string signature_to_string(Signature s) {
+  string res;
+  do {
+    res.insert(res.begin(), '0' + (char)(s % 10));
+    s /= 10;
+  } while (s);
+  return res;
+}
+
+static Signature parse_signature(const char *str) {
+  Signature s = 0;
+  for (; *str >= '0' && *str <= '9'; str++)
+    s = s * 10 + (*str - '0');
+  return s;
+}
+
+struct KeyEntry {
+  unsigned line;
+  unsigned column;
+  long steps;
+  string var;
+  long long expected;
+  string function;
+  // filled in while running
+  long hits = 0;
+  optional<long long> value;
+};
+
+struct KeyFile {
+  optional<Signature> signature;
+  // moduli of the parts, the first primes for keys without `# moduli=`
+  vector<long long> moduli;
+  // section of a -nt-side-table key, its entries are indexed by the column
+  string sideTable;
+  vector<KeyEntry> entries;
+};
+
+/**
+ * Parses `# signature=S`, `# moduli=n1,n2,...` and the lines
+ * `line column iterations var_name expected_value [function_name
+ * [extraction_cost]]`
+ */
+static KeyFile parse_key_file(const string &path) {
+  KeyFile key;
+  ifstream file(path);
+  string line;
+  while (getline(file, line)) {
+    if (line.rfind("# signature=", 0) == 0) {
+      key.signature = parse_signature(line.c_str() + strlen("# signature="));
+      continue;
+    }
+    if (line.rfind("# moduli=", 0) == 0) {
+      istringstream moduli(line.substr(strlen("# moduli=")));
+      string modulus;
+      while (getline(moduli, modulus, ','))
+        key.moduli.push_back(atoll(modulus.c_str()));
+      continue;
+    }
+    if (line.rfind("# side-table=", 0) == 0) {
+      key.sideTable = line.substr(strlen("# side-table="));
+      continue;
+    }
+    if (line.empty() || line[0] == '#')
+      continue;
+    istringstream fields(line);
+    KeyEntry entry;
+    if (!(fields >> entry.line >> entry.column >> entry.steps >> entry.var >>
+          entry.expected))
+      continue;
+    fields >> entry.function;
+    key.entries.push_back(entry);
+  }
+  return key;
+}
+
+/**
+ * Location of a variable relative to the registers of the stopped program
+ */
+struct VarLocation {
+  enum { FRAME_BASE, REGISTER_MEMORY, REGISTER } kind;
+  unsigned reg;
+  int64_t offset;
+};
+
+/**
+ * Frame base of a function: a register, or the CFA taken from .eh_frame
+ */
+struct FrameBase {
+  bool cfa;
+  unsigned reg;
+};
+
+/**
+ * Everything the tracer needs for one key entry
+ */
+struct Watermark {
+  vector<uint64_t> addresses;
+  DWARFDie function;
+  DWARFDie variable;
+  optional<VarLocation> location;
+  optional<FrameBase> frameBase;
+  // link time address of a global variable (side table)
+  optional<uint64_t> storage;
+  // size of the variable in bytes
+  unsigned size = 8;
+};
+
+// sign-extends the low `size` bytes of a value
+static long long truncate(uint64_t value, unsigned size) {
+  return size == 4 ? (long long)(int32_t)value : (long long)value;
+}
+
+/**
+ * Byte size of a variable's type (through qualifiers and typedefs)
+ */
+static unsigned variable_size(DWARFDie var) {
+  DWARFDie type = var.getAttributeValueAsReferencedDie(dwarf::DW_AT_type);
+  while (type) {
+    if (auto size = dwarf::toUnsigned(type.find(dwarf::DW_AT_byte_size)))
+      return *size;
+    type = type.getAttributeValueAsReferencedDie(dwarf::DW_AT_type);
+  }
+  return 4;
+}
+
+static void collect_subprograms(DWARFDie die, const string &name,
+                                vector<DWARFDie> &res) {
+  for (DWARFDie child : die.children()) {
+    if (child.getTag() == dwarf::DW_TAG_subprogram &&
+        child.find(dwarf::DW_AT_low_pc)) {
+      const char *childName = child.getName(DINameKind::ShortName);
+      if (!name.empty() && childName && name == childName)
+        res.push_back(child);
+    }
+    collect_subprograms(child, name, res);
+  }
+}
+
+static DWARFDie find_variable(DWARFDie die, const string &name) {
+  for (DWARFDie child : die.children()) {
+    if ((child.getTag() == dwarf::DW_TAG_variable ||
+         child.getTag() == dwarf::DW_TAG_formal_parameter)) {
+      const char *childName = child.getName(DINameKind::ShortName);
+      if (childName && name == childName)
+        return child;
+    }
+    if (child.getTag() == dwarf::DW_TAG_lexical_block)
+      if (DWARFDie res = find_variable(child, name))
+        return res;
+  }
+  return DWARFDie();
+}
+
+static bool in_ranges(DWARFDie function, uint64_t address) {
+  if (!function)
+    return true;
+  auto ranges = function.getAddressRanges();
+  if (!ranges) {
+    consumeError(ranges.takeError());
+    return false;
+  }
+  for (const DWARFAddressRange &range : *ranges)
+    if (range.LowPC <= address && address < range.HighPC)
+      return true;
+  return false;
+}
+
+static uint64_t low_pc(DWARFDie function) {
+  uint64_t low = 0, high, section;
+  function.getLowAndHighPC(low, high, section);
+  return low;
+}
+
+/**
+ * Addresses of line:column inside `function` (any column if column is 0).
+ * Like lldb, only the first address of every run of rows for the location is
+ * used, so a location hits once per execution.
+ */
+static vector<uint64_t> find_addresses(DWARFContext &ctx, unsigned line,
+                                       unsigned column, DWARFDie function) {
+  set<uint64_t> res;
+  for (const auto &cu : ctx.compile_units()) {
+    const DWARFDebugLine::LineTable *table = ctx.getLineTableForUnit(cu.get());
+    if (!table)
+      continue;
+    bool previous = false;
+    for (const DWARFDebugLine::Row &row : table->Rows) {
+      bool match = !row.EndSequence && row.Line == line &&
+                   (column == 0 || row.Column == column);
+      // the probes have columns of their own but need not start a statement
+      if (match && !previous && (column || row.IsStmt) &&
+          in_ranges(function, row.Address.Address))
+        res.insert(row.Address.Address);
+      previous = match;
+    }
+  }
+  return vector<uint64_t>(res.begin(), res.end());
+}
+
+/**
+ * Decodes the single-operation DWARF expressions clang and gcc emit for stack
+ * variables and frame bases
+ */
+static optional<VarLocation> decode_location(ArrayRef<uint8_t> expr) {
+  if (expr.empty())
+    return nullopt;
+  uint8_t op = expr[0];
+  const uint8_t *data = expr.data() + 1;
+  const uint8_t *end = expr.data() + expr.size();
+  if (op == dwarf::DW_OP_fbreg)
+    return VarLocation{VarLocation::FRAME_BASE, 0,
+                       decodeSLEB128(data, nullptr, end)};
+  if (op >= dwarf::DW_OP_breg0 && op <= dwarf::DW_OP_breg31)
+    return VarLocation{VarLocation::REGISTER_MEMORY,
+                       (unsigned)(op - dwarf::DW_OP_breg0),
+                       decodeSLEB128(data, nullptr, end)};
+  if (op >= dwarf::DW_OP_reg0 && op <= dwarf::DW_OP_reg31)
+    return VarLocation{VarLocation::REGISTER, (unsigned)(op - dwarf::DW_OP_reg0),
+                       0};
+  return nullopt;
+}
+
+static optional<FrameBase> decode_frame_base(DWARFDie function) {
+  auto attr = function.find(dwarf::DW_AT_frame_base);
+  if (!attr)
+    return nullopt;
+  auto block = attr->getAsBlock();
+  if (!block || block->empty())
+    return nullopt;
+  uint8_t op = (*block)[0];
+  if (op == dwarf::DW_OP_call_frame_cfa)
+    return FrameBase{true, 0};
+  if (op >= dwarf::DW_OP_reg0 && op <= dwarf::DW_OP_reg31)
+    return FrameBase{false, (unsigned)(op - dwarf::DW_OP_reg0)};
+  return nullopt;
+}
+
+/**
+ * Location of the variable at `address`, location lists are resolved
+ */
+static optional<VarLocation> variable_location(DWARFDie var,
+                                               uint64_t address) {
+  auto locations = var.getLocations(dwarf::DW_AT_location);
+  if (!locations) {
+    consumeError(locations.takeError());
+    return nullopt;
+  }
+  for (const auto &location : *locations) {
+    if (!location.Range || (location.Range->LowPC <= address &&
+                            address < location.Range->HighPC))
+      return decode_location(location.Expr);
+  }
+  return nullopt;
+}
+
+// value of DWARF register `reg` (x86-64 numbering)
+static optional<uint64_t> read_register(const user_regs_struct &regs,
+                                        unsigned reg) {
+  switch (reg) {
+  case 0: return regs.rax;
+  case 1: return regs.rdx;
+  case 2: return regs.rcx;
+  case 3: return regs.rbx;
+  case 4: return regs.rsi;
+  case 5: return regs.rdi;
+  case 6: return regs.rbp;
+  case 7: return regs.rsp;
+  case 8: return regs.r8;
+  case 9: return regs.r9;
+  case 10: return regs.r10;
+  case 11: return regs.r11;
+  case 12: return regs.r12;
+  case 13: return regs.r13;
+  case 14: return regs.r14;
+  case 15: return regs.r15;
+  case 16: return regs.rip;
+  default: return nullopt;
+  }
+}
+
+/**
+ * CFA rule (DWARF register + offset) at `address` (link time) from .eh_frame
+ * or .debug_frame, other rules are not supported
+ */
+static optional<pair<unsigned, int64_t>> cfa_rule(DWARFContext &ctx,
+                                                  uint64_t address) {
+  for (bool eh : {true, false}) {
+    auto frames = eh ? ctx.getEHFrame() : ctx.getDebugFrame();
+    if (!frames) {
+      consumeError(frames.takeError());
+      continue;
+    }
+    for (const dwarf::FrameEntry &entry : **frames) {
+      const auto *fde = dyn_cast<dwarf::FDE>(&entry);
+      if (!fde || address < fde->getInitialLocation() ||
+          address >= fde->getInitialLocation() + fde->getAddressRange())
+        continue;
+      auto table = dwarf::UnwindTable::create(fde);
+      if (!table) {
+        consumeError(table.takeError());
+        return nullopt;
+      }
+      optional<pair<unsigned, int64_t>> rule;
+      for (const dwarf::UnwindRow &row : *table) {
+        if (row.hasAddress() && row.getAddress() > address)
+          break;
+        const dwarf::UnwindLocation &value = row.getCFAValue();
+        if (value.getLocation() != dwarf::UnwindLocation::RegPlusOffset)
+          return nullopt;
+        rule = make_pair(value.getRegister(), (int64_t)value.getOffset());
+      }
+      return rule;
+    }
+  }
+  return nullopt;
+}
+
+// canonical frame address at `address` in the stopped program
+static optional<uint64_t> compute_cfa(DWARFContext &ctx, uint64_t address,
+                                      const user_regs_struct &regs) {
+  auto rule = cfa_rule(ctx, address);
+  if (!rule)
+    return nullopt;
+  auto reg = read_register(regs, rule->first);
+  if (!reg)
+    return nullopt;
+  return *reg + rule->second;
+}
+
+/**
+ * Reads the (integer) variable of `target` in the stopped program
+ */
+static optional<long long> read_variable(pid_t pid, DWARFContext &ctx,
+                                         const Watermark &target,
+                                         uint64_t address, uint64_t bias) {
+  if (target.storage) {
+    errno = 0;
+    long word =
+        ptrace(PTRACE_PEEKDATA, pid, (void *)(*target.storage + bias), nullptr);
+    if (errno)
+      return nullopt;
+    return truncate(word, target.size);
+  }
+  if (!target.location)
+    return nullopt;
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) != 0)
+    return nullopt;
+  const VarLocation &location = *target.location;
+  uint64_t memory;
+  if (location.kind == VarLocation::REGISTER) {
+    auto value = read_register(regs, location.reg);
+    if (!value)
+      return nullopt;
+    return truncate(*value, target.size);
+  } else if (location.kind == VarLocation::REGISTER_MEMORY) {
+    auto reg = read_register(regs, location.reg);
+    if (!reg)
+      return nullopt;
+    memory = *reg + location.offset;
+  } else {
+    if (!target.frameBase)
+      return nullopt;
+    optional<uint64_t> base =
+        target.frameBase->cfa ? compute_cfa(ctx, address, regs)
+                              : read_register(regs, target.frameBase->reg);
+    if (!base)
+      return nullopt;
+    memory = *base + location.offset;
+  }
+  errno = 0;
+  long word = ptrace(PTRACE_PEEKDATA, pid, (void *)memory, nullptr);
+  if (errno)
+    return nullopt;
+  return truncate(word, target.size);
+}
+
+/**
+ * Reads the -nt-side-table section: entries of four 32 bit words, the
+ * breakpoint and the variable relative to the entry, the entry's index and
+ * iteration. Returns index -> (breakpoint, variable) at link time.
+ */
+static map<int32_t, pair<uint64_t, uint64_t>>
+read_side_table(object::ObjectFile &obj, const string &name) {
+  map<int32_t, pair<uint64_t, uint64_t>> res;
+  if (name.empty())
+    return res;
+  for (const object::SectionRef &section : obj.sections()) {
+    auto sectionName = section.getName();
+    if (!sectionName) {
+      consumeError(sectionName.takeError());
+      continue;
+    }
+    if (*sectionName != name)
+      continue;
+    auto contents = section.getContents();
+    if (!contents) {
+      consumeError(contents.takeError());
+      continue;
+    }
+    for (size_t offset = 0; offset + 16 <= contents->size(); offset += 16) {
+      int32_t words[4];
+      memcpy(words, contents->data() + offset, sizeof(words));
+      uint64_t entry = section.getAddress() + offset;
+      res[words[2]] = {entry + words[0], entry + words[1]};
+    }
+  }
+  return res;
+}
+
+/**
+ * Load address of the program's first mapping, taken from /proc/<pid>/maps
+ */
+static optional<uint64_t> load_base(pid_t pid, const string &program) {
+  char resolved[PATH_MAX];
+  if (!realpath(program.c_str(), resolved))
+    return nullopt;
+  ifstream maps("/proc/" + to_string(pid) + "/maps");
+  string line;
+  while (getline(maps, line)) {
+    istringstream fields(line);
+    string range, perms, offset, dev, inode, path;
+    fields >> range >> perms >> offset >> dev >> inode >> path;
+    if (path == resolved && strtoull(offset.c_str(), nullptr, 16) == 0)
+      return strtoull(range.c_str(), nullptr, 16);
+  }
+  return nullopt;
+}
+
+static bool wait_stopped(pid_t pid, int &status) {
+  if (waitpid(pid, &status, 0) != pid)
+    return false;
+  return WIFSTOPPED(status);
+}
+
+/**
+ * Runs the program once and fills in the hits and values of all entries
+ */
+static bool trace(const string &program, const vector<string> &args,
+                  const string &input_file, DWARFContext &ctx,
+                  bool position_independent, uint64_t link_base,
+                  KeyFile &key, vector<Watermark> &targets, bool verbose) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!input_file.empty()) {
+      int fd = open(input_file.c_str(), O_RDONLY);
+      if (fd >= 0) {
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+      }
+    }
+    // the program's output is not part of the report
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+      dup2(null, STDOUT_FILENO);
+    vector<char *> argv{const_cast<char *>(program.c_str())};
+    for (const string &arg : args)
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    execv(program.c_str(), argv.data());
+    _exit(127);
+  }
+  int status;
+  // stopped after exec, the program is mapped but did not run yet
+  if (!wait_stopped(pid, status)) {
+    fprintf(stderr, "could not start %s\n", program.c_str());
+    return false;
+  }
+  ptrace(PTRACE_SETOPTIONS, pid, nullptr, (void *)PTRACE_O_EXITKILL);
+  uint64_t bias = 0;
+  if (position_independent) {
+    auto base = load_base(pid, program);
+    if (!base) {
+      fprintf(stderr, "could not find the load address of %s\n",
+              program.c_str());
+      kill(pid, SIGKILL);
+      return false;
+    }
+    bias = *base - link_base;
+  }
+  // arm all breakpoints, remembering the original words
+  map<uint64_t, vector<size_t>> entries_at;
+  map<uint64_t, long> original;
+  size_t pending = 0;
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (targets[i].addresses.empty())
+      continue;
+    pending++;
+    for (uint64_t address : targets[i].addresses)
+      entries_at[address + bias].push_back(i);
+  }
+  for (auto &[address, _] : entries_at) {
+    errno = 0;
+    long word = ptrace(PTRACE_PEEKTEXT, pid, (void *)address, nullptr);
+    if (errno)
+      continue;
+    original[address] = word;
+    ptrace(PTRACE_POKETEXT, pid, (void *)address,
+           (void *)((word & ~0xFFL) | 0xCC));
+  }
+  int signal = 0;
+  while (pending > 0) {
+    ptrace(PTRACE_CONT, pid, nullptr, (void *)(long)signal);
+    signal = 0;
+    if (!wait_stopped(pid, status))
+      break; // exited
+    if (WSTOPSIG(status) != SIGTRAP) {
+      signal = WSTOPSIG(status);
+      continue;
+    }
+    user_regs_struct regs;
+    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+    uint64_t address = regs.rip - 1;
+    auto it = original.find(address);
+    if (it == original.end())
+      continue;
+    regs.rip = address;
+    ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+    bool needed = false;
+    for (size_t i : entries_at[address]) {
+      KeyEntry &entry = key.entries[i];
+      if (entry.value || entry.hits >= entry.steps)
+        continue;
+      if (++entry.hits == entry.steps) {
+        entry.value =
+            read_variable(pid, ctx, targets[i], address - bias, bias);
+        pending--;
+        if (verbose)
+          printf("hit %s at 0x%lx (%ld)\n", entry.var.c_str(),
+                 (unsigned long)address, entry.hits);
+      } else {
+        needed = true;
+      }
+    }
+    // step over the original instruction, re-arm only if still needed
+    ptrace(PTRACE_POKETEXT, pid, (void *)address, (void *)it->second);
+    if (!needed) {
+      original.erase(it);
+      continue;
+    }
+    ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+    if (!wait_stopped(pid, status))
+      break;
+    ptrace(PTRACE_POKETEXT, pid, (void *)address,
+           (void *)((it->second & ~0xFFL) | 0xCC));
+  }
+  // all values are read, the rest of the run does not matter
+  kill(pid, SIGKILL);
+  waitpid(pid, &status, 0);
+  return true;
+}
+
+/**
+ * MC objects to disassemble the program for the static mode
+ */
+struct Disassembler {
+  unique_ptr<const MCRegisterInfo> registers;
+  unique_ptr<const MCAsmInfo> asmInfo;
+  unique_ptr<const MCSubtargetInfo> subtarget;
+  unique_ptr<const MCInstrInfo> instructions;
+  unique_ptr<MCContext> context;
+  unique_ptr<const MCDisassembler> disassembler;
+};
+
+static optional<Disassembler> create_disassembler(object::ObjectFile &obj) {
+  InitializeAllTargetInfos();
+  InitializeAllTargetMCs();
+  InitializeAllDisassemblers();
+  Triple triple = obj.makeTriple();
+  string error;
+  const llvm::Target *target = TargetRegistry::lookupTarget(triple.str(), error);
+  if (!target) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return nullopt;
+  }
+  Disassembler res;
+  res.registers.reset(target->createMCRegInfo(triple.str()));
+  res.asmInfo.reset(
+      target->createMCAsmInfo(*res.registers, triple.str(), MCTargetOptions()));
+  res.subtarget.reset(target->createMCSubtargetInfo(triple.str(), "", ""));
+  res.instructions.reset(target->createMCInstrInfo());
+  if (!res.registers || !res.asmInfo || !res.subtarget || !res.instructions)
+    return nullopt;
+  res.context = make_unique<MCContext>(triple, res.asmInfo.get(),
+                                       res.registers.get(),
+                                       res.subtarget.get());
+  res.disassembler.reset(
+      target->createMCDisassembler(*res.subtarget, *res.context));
+  if (!res.disassembler)
+    return nullopt;
+  return res;
+}
+
+/**
+ * Address of the variable at `address` as (MC register, displacement)
+ */
+static optional<pair<unsigned, int64_t>>
+variable_slot(DWARFContext &ctx, const Watermark &target, uint64_t address,
+              const MCRegisterInfo &registers) {
+  optional<VarLocation> location = variable_location(target.variable, address);
+  if (!location || location->kind == VarLocation::REGISTER)
+    return nullopt;
+  unsigned reg = location->reg;
+  int64_t offset = location->offset;
+  if (location->kind == VarLocation::FRAME_BASE) {
+    if (!target.frameBase)
+      return nullopt;
+    reg = target.frameBase->reg;
+    if (target.frameBase->cfa) {
+      auto rule = cfa_rule(ctx, address);
+      if (!rule)
+        return nullopt;
+      reg = rule->first;
+      offset += rule->second;
+    }
+  }
+  auto mcReg = registers.getLLVMRegNum(reg, false);
+  if (!mcReg)
+    return nullopt;
+  return make_pair((unsigned)*mcReg, offset);
+}
+
+// whether the x86 memory operand starting at `first` addresses `slot`
+static bool is_slot(const MCInst &inst, unsigned first,
+                    const optional<pair<unsigned, int64_t>> &slot) {
+  if (!slot || inst.getNumOperands() < first + 5)
+    return false;
+  const MCOperand &base = inst.getOperand(first);
+  const MCOperand &index = inst.getOperand(first + 2);
+  const MCOperand &disp = inst.getOperand(first + 3);
+  const MCOperand &segment = inst.getOperand(first + 4);
+  return base.isReg() && (unsigned)base.getReg() == slot->first &&
+         index.isReg() && !index.getReg() && disp.isImm() &&
+         disp.getImm() == slot->second && segment.isReg() &&
+         !segment.getReg();
+}
+
+/**
+ * Recovers x0 (the immediate stored into the variable, directly or through a
+ * register) and r (the immediate added to it between a load and a store of
+ * the variable) from the function of `target` and computes the value at
+ * iteration `steps`. 32 and 64 bit variables are supported.
+ */
+static optional<long long> extract_static(object::ObjectFile &obj,
+                                          DWARFContext &ctx,
+                                          Disassembler &dis,
+                                          const Watermark &target, long steps,
+                                          bool verbose) {
+  if (!target.function || !target.variable)
+    return nullopt;
+  auto ranges = target.function.getAddressRanges();
+  if (!ranges) {
+    consumeError(ranges.takeError());
+    return nullopt;
+  }
+  const MCRegisterInfo &registers = *dis.registers;
+  optional<int64_t> x0, r;
+  for (const DWARFAddressRange &range : *ranges) {
+    for (const object::SectionRef &section : obj.sections()) {
+      uint64_t start = section.getAddress();
+      if (!section.isText() || range.LowPC < start ||
+          range.HighPC > start + section.getSize())
+        continue;
+      auto contents = section.getContents();
+      if (!contents) {
+        consumeError(contents.takeError());
+        continue;
+      }
+      ArrayRef<uint8_t> bytes(
+          (const uint8_t *)contents->data() + (range.LowPC - start),
+          range.HighPC - range.LowPC);
+      // register holding the loaded variable, and the stepped value
+      optional<unsigned> loaded, stepped;
+      optional<int64_t> step;
+      // registers holding an immediate (movabs of a wide x0)
+      map<unsigned, int64_t> constants;
+      uint64_t size;
+      for (uint64_t offset = 0; offset < bytes.size(); offset += size) {
+        MCInst inst;
+        uint64_t address = range.LowPC + offset;
+        if (dis.disassembler->getInstruction(inst, size, bytes.slice(offset),
+                                             address, nulls()) !=
+            MCDisassembler::Success) {
+          size = size ? size : 1;
+          continue;
+        }
+        string name = dis.instructions->getName(inst.getOpcode()).str();
+        auto slot = variable_slot(ctx, target, address, registers);
+        auto sameReg = [&](const optional<unsigned> &reg, unsigned operand) {
+          return reg && inst.getOperand(operand).isReg() &&
+                 registers.isSuperOrSubRegisterEq(
+                     *reg, inst.getOperand(operand).getReg());
+        };
+        // opcode of either width, e.g. is("ADD", "ri") for ADD32ri8
+        auto is = [&](const char *op, const char *form) {
+          return name.rfind(string(op) + "32" + form, 0) == 0 ||
+                 name.rfind(string(op) + "64" + form, 0) == 0;
+        };
+        auto setX0 = [&](int64_t value) {
+          if (x0)
+            return;
+          x0 = value;
+          if (verbose)
+            printf("  x0 = %lld at 0x%lx\n", (long long)*x0,
+                   (unsigned long)address);
+        };
+        // instructions writing a register forget its constant
+        optional<unsigned> written;
+        if (dis.instructions->get(inst.getOpcode()).getNumDefs() > 0 &&
+            inst.getOperand(0).isReg())
+          written = (unsigned)inst.getOperand(0).getReg();
+        if (is("MOV", "mi") && is_slot(inst, 0, slot)) {
+          setX0(inst.getOperand(5).getImm());
+        } else if (is("MOV", "rm") && is_slot(inst, 1, slot)) {
+          loaded = (unsigned)inst.getOperand(0).getReg();
+          stepped.reset();
+        } else if ((is("ADD", "ri") || is("SUB", "ri")) &&
+                   sameReg(loaded, 0)) {
+          int64_t imm = inst.getOperand(2).getImm();
+          step = name.rfind("SUB", 0) == 0 ? -imm : imm;
+          stepped = loaded;
+        } else if ((is("INC", "r") || is("DEC", "r")) && sameReg(loaded, 0)) {
+          step = name.rfind("INC", 0) == 0 ? 1 : -1;
+          stepped = loaded;
+        } else if (name.rfind("LEA", 0) == 0 && sameReg(loaded, 1) &&
+                   !inst.getOperand(3).getReg()) {
+          step = inst.getOperand(4).getImm();
+          stepped = (unsigned)inst.getOperand(0).getReg();
+        } else if (is("MOV", "ri") && inst.getOperand(1).isImm()) {
+          unsigned reg = (unsigned)inst.getOperand(0).getReg();
+          int64_t imm = inst.getOperand(1).getImm();
+          // 32 bit moves zero the upper half
+          constants[reg] = name.rfind("MOV32", 0) == 0 ? (uint32_t)imm : imm;
+          written.reset();
+        } else if (is("MOV", "mr") && is_slot(inst, 0, slot) && !stepped &&
+                   constants.count((unsigned)inst.getOperand(5).getReg())) {
+          setX0(constants[(unsigned)inst.getOperand(5).getReg()]);
+        } else if (is("MOV", "mr") && is_slot(inst, 0, slot) &&
+                   sameReg(stepped, 5)) {
+          // the stepped value is written back: load, add, store found
+          if (!r) {
+            r = step;
+            if (verbose)
+              printf("  r = %lld at 0x%lx\n", (long long)*r,
+                     (unsigned long)address);
+          }
+          loaded.reset();
+          stepped.reset();
+        } else if ((is("ADD", "mi") || is("SUB", "mi")) &&
+                   is_slot(inst, 0, slot)) {
+          if (!r) {
+            int64_t imm = inst.getOperand(5).getImm();
+            r = name.rfind("SUB", 0) == 0 ? -imm : imm;
+          }
+        } else if ((is("INC", "m") || is("DEC", "m")) &&
+                   is_slot(inst, 0, slot)) {
+          if (!r)
+            r = name.rfind("INC", 0) == 0 ? 1 : -1;
+        }
+        if (written) {
+          for (auto it = constants.begin(); it != constants.end();)
+            it = registers.isSuperOrSubRegisterEq(it->first, *written)
+                     ? constants.erase(it)
+                     : next(it);
+        }
+      }
+    }
+  }
+  if (!x0 || !r)
+    return nullopt;
+  return truncate((uint64_t)*x0 + (uint64_t)*r * steps, target.size);
+}
+
+static vector<long long> generate_primes(size_t n) {
+  vector<long long> primes;
+  for (long long num = 2; primes.size() < n; num++) {
+    bool prime = true;
+    for (long long p : primes) {
+      if (p * p > num)
+        break;
+      if (num % p == 0) {
+        prime = false;
+        break;
+      }
+    }
+    if (prime)
+      primes.push_back(num);
+  }
+  return primes;
+}
+
+static long long mod_inverse(long long a, long long m) {
+  long long t = 0, newt = 1, r = m, newr = ((a % m) + m) % m;
+  while (newr) {
+    long long q = r / newr;
+    tie(t, newt) = make_pair(newt, t - q * newt);
+    tie(r, newr) = make_pair(newr, r - q * newr);
+  }
+  return r == 1 ? (t % m + m) % m : -1;
+}
+
+/**
+ * Chinese remainder theorem with Garner's mixed radix form, which only
+ * computes modulo single moduli: S = d0 + d1 n0 + d2 n0 n1 + ... never
+ * exceeds 128 bits for a valid signature, even if the product N does
+ */
+static optional<Signature> reconstruct(const vector<long long> &b,
+                                       const vector<long long> &n) {
+  vector<long long> digits;
+  for (size_t i = 0; i < n.size(); i++) {
+    long long v = ((b[i] % n[i]) + n[i]) % n[i];
+    for (size_t j = 0; j < i; j++) {
+      long long inverse = mod_inverse(n[j] % n[i], n[i]);
+      if (inverse < 0)
+        return nullopt;
+      v = (long long)((__int128)((v - digits[j] % n[i]) + n[i]) % n[i] *
+                      inverse % n[i]);
+    }
+    digits.push_back(v);
+  }
+  Signature S = 0, radix = 1;
+  for (size_t i = 0; i < n.size(); i++) {
+    S += radix * (Signature)digits[i];
+    radix *= (Signature)n[i];
+  }
+  return S;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "usage: %s <program> <key file> [--static] [--input <string>] "
+            "[--input-file <file>] [--verbose] [-- <program arguments>...]\n",
+            argv[0]);
+    return 1;
+  }
+  string program = argv[1];
+  KeyFile key = parse_key_file(argv[2]);
+  string input_file;
+  bool verbose = false;
+  bool static_mode = false;
+  vector<string> args;
+  char temp_input[] = "/tmp/nt-extractor-XXXXXX";
+  bool temp_created = false;
+  for (int i = 3; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--") {
+      args.assign(argv + i + 1, argv + argc);
+      break;
+    } else if ((arg == "--input" || arg == "-i") && i + 1 < argc) {
+      int fd = mkstemp(temp_input);
+      if (fd >= 0) {
+        string input = argv[++i];
+        if (write(fd, input.data(), input.size()) < 0)
+          perror("write");
+        close(fd);
+        input_file = temp_input;
+        temp_created = true;
+      }
+    } else if ((arg == "--input-file" || arg == "-f") && i + 1 < argc) {
+      input_file = argv[++i];
+    } else if (arg == "--verbose" || arg == "-v") {
+      verbose = true;
+    } else if (arg == "--static" || arg == "-s") {
+      static_mode = true;
+    }
+  }
+  if (key.entries.empty()) {
+    printf(RED "ERROR: No watermarks found in key file" RESET "\n");
+    return 1;
+  }
+  printf("Found %zu watermark(s) to verify\n", key.entries.size());
+  if (key.signature)
+    printf("Expected signature: %s\n",
+           signature_to_string(*key.signature).c_str());
+  auto binary = object::ObjectFile::createObjectFile(program);
+  if (!binary) {
+    fprintf(stderr, "%s: %s\n", program.c_str(),
+            toString(binary.takeError()).c_str());
+    return 1;
+  }
+  object::ObjectFile &obj = *binary->getBinary();
+  unique_ptr<DWARFContext> ctx = DWARFContext::create(obj);
+  // PIE binaries are relocated by the difference of their first mapping
+  bool position_independent = false;
+  uint64_t link_base = 0;
+  if (auto *elf = dyn_cast<object::ELF64LEObjectFile>(&obj)) {
+    position_independent = elf->getELFFile().getHeader().e_type == ELF::ET_DYN;
+    auto headers = elf->getELFFile().program_headers();
+    if (headers) {
+      for (const auto &header : *headers)
+        if (header.p_type == ELF::PT_LOAD && header.p_offset == 0) {
+          link_base = header.p_vaddr & ~0xFFFULL;
+          break;
+        }
+    } else {
+      consumeError(headers.takeError());
+    }
+  }
+  if (static_mode && !key.sideTable.empty()) {
+    fprintf(stderr, "--static needs debug information, not a side table\n");
+    return 1;
+  }
+  auto side_table = read_side_table(obj, key.sideTable);
+  // resolve all entries before the single run
+  vector<Watermark> targets;
+  for (KeyEntry &entry : key.entries) {
+    Watermark target;
+    if (!key.sideTable.empty()) {
+      auto it = side_table.find(entry.column);
+      if (it != side_table.end()) {
+        target.addresses = {it->second.first};
+        target.storage = it->second.second;
+      }
+      if (verbose)
+        printf("%s: side table entry %u %s\n", entry.var.c_str(),
+               entry.column, it != side_table.end() ? "found" : "missing");
+      targets.push_back(target);
+      continue;
+    }
+    vector<DWARFDie> functions;
+    for (const auto &cu : ctx->compile_units())
+      collect_subprograms(cu->getUnitDIE(false), entry.function, functions);
+    for (DWARFDie function : functions.empty() ? vector<DWARFDie>{DWARFDie()}
+                                               : functions) {
+      target.addresses =
+          find_addresses(*ctx, entry.line, entry.column, function);
+      // fall back to the line alone, like extractor.py
+      if (target.addresses.empty() && entry.column)
+        target.addresses = find_addresses(*ctx, entry.line, 0, function);
+      if (!target.addresses.empty()) {
+        target.function = function;
+        break;
+      }
+    }
+    // the static mode only needs the function
+    if (!target.function && static_mode && !functions.empty())
+      target.function = functions[0];
+    if (target.function) {
+      target.variable = find_variable(target.function, entry.var);
+      if (target.variable)
+        target.size = variable_size(target.variable);
+      uint64_t at = target.addresses.empty() ? low_pc(target.function)
+                                             : target.addresses[0];
+      if (target.variable)
+        target.location = variable_location(target.variable, at);
+      target.frameBase = decode_frame_base(target.function);
+    }
+    if (verbose)
+      printf("%s: %zu address(es), %s location\n", entry.var.c_str(),
+             target.addresses.size(), target.location ? "known" : "unknown");
+    targets.push_back(target);
+  }
+  if (static_mode) {
+    optional<Disassembler> dis = create_disassembler(obj);
+    if (!dis) {
+      fprintf(stderr, "could not create a disassembler for %s\n",
+              program.c_str());
+      return 1;
+    }
+    for (size_t i = 0; i < targets.size(); i++) {
+      if (verbose)
+        printf("%s:\n", key.entries[i].var.c_str());
+      key.entries[i].value = extract_static(obj, *ctx, *dis, targets[i],
+                                            key.entries[i].steps, verbose);
+    }
+  } else {
+    trace(program, args, input_file, *ctx, position_independent, link_base,
+          key, targets, verbose);
+  }
+  if (temp_created)
+    unlink(temp_input);
+  // report like extractor.py
+  vector<long long> moduli = key.moduli.size() == key.entries.size()
+                                ? key.moduli
+                                : generate_primes(key.entries.size());
+  printf("Using moduli:");
+  for (long long n : moduli)
+    printf(" %lld", n);
+  printf("\n");
+  size_t correct = 0;
+  vector<long long> values;
+  for (const KeyEntry &entry : key.entries) {
+    if (!entry.value && static_mode) {
+      printf("  " RED "FAILED" RESET " - Could not extract value for %s "
+             "(no x0/r pattern in %s)\n",
+             entry.var.c_str(), entry.function.c_str());
+      continue;
+    } else if (!entry.value) {
+      printf("  " RED "FAILED" RESET " - Could not extract value for %s "
+             "(%ld of %ld hits)\n",
+             entry.var.c_str(), entry.hits, entry.steps);
+      continue;
+    }
+    values.push_back(*entry.value);
+    if (*entry.value == entry.expected) {
+      printf("  " GREEN "OK" RESET " - %s = %lld (expected %lld)\n",
+             entry.var.c_str(), *entry.value, entry.expected);
+      correct++;
+    } else {
+      printf("  " RED "MISMATCH" RESET " - %s = %lld (expected %lld)\n",
+             entry.var.c_str(), *entry.value, entry.expected);
+    }
+  }
+  printf("\n========================================\n");
+  if (values.size() == key.entries.size()) {
+    auto signature = reconstruct(values, moduli);
+    if (signature) {
+      printf("Reconstructed signature (CRT): %s\n",
+             signature_to_string(*signature).c_str());
+      if (key.signature) {
+        if (*signature == *key.signature)
+          printf(GREEN "SIGNATURE VERIFIED" RESET "\n");
+        else
+          printf(RED "SIGNATURE MISMATCH" RESET " (expected %s)\n",
+                 signature_to_string(*key.signature).c_str());
+      }
+    }
+  }
+  printf("========================================\n");
+  bool success = correct == key.entries.size();
+  printf("%s%s" RESET "\n", success ? GREEN : RED,
+         success ? "SUCCESS" : "FAILURE");
+  printf("%s%zu/%zu watermarks verified" RESET "\n", success ? GREEN : RED,
+         correct, key.entries.size());
+  return success ? 0 : 1;
+}
@@ -18,12 +18,14 @@ class colors:
 
 def parse_key_file(key_path):
     """
-    Parse the key file and extract signature and watermark entries.
-    Returns: (signature, watermarks) where watermarks is a list of tuples
-    Format: line column iterations var_name expected_value [function_name]
+    Parse the key file and extract signature, moduli and watermark entries.
+    Returns: (signature, watermarks, moduli) where watermarks is a list of tuples
+    and moduli is None for keys without a '# moduli=' line (first k primes)
+    Format: line column iterations var_name expected_value [function_name [extraction_cost]]
     """
     signature = None
     watermarks = []
+    moduli = None
 
     with open(key_path, 'r') as file:
         for line in file:
@@ -36,6 +38,17 @@ def parse_key_file(key_path):
                 signature = int(line.split('=')[1])
                 continue
 
+            if line.startswith('# moduli='):
+                moduli = [int(n) for n in line.split('=')[1].split(',')]
+                continue
+
+            # Side-table keys (-nt-side-table) refer to a section instead of
+            # debug locations, lldb cannot resolve them
+            if line.startswith('# side-table='):
+                print(f"{colors.RED}ERROR: Key refers to the side table '{line.split('=')[1]}', "
+                      f"use nt-extractor{colors.RESET}")
+                sys.exit(1)
+
             # Skip other comment lines
             if line.startswith('#'):
                 continue
@@ -52,7 +65,7 @@ def parse_key_file(key_path):
                 func_name = s_values[5] if len(s_values) >= 6 else None
                 watermarks.append((line_nr, column_nr, steps, var_name, expected_res, func_name))
 
-    return signature, watermarks
+    return signature, watermarks, moduli
 
 
 def extract_watermark_value(lldb_path, filename, line_nr, column_nr, steps, var_name, func_name=None, program_input=None, program_args=None):
@@ -121,8 +134,8 @@ def extract_watermark_value(lldb_path, filename, line_nr, column_nr, steps, var_
 
                 # Parse the variable value from output
                 if output:
-                    # Look for pattern like "var_name = value"
-                    pattern = rf"\({re.escape('int')}\)\s*{re.escape(var_name)}\s*=\s*(-?\d+)"
+                    # Look for pattern like "(long long) var_name = value"
+                    pattern = rf"\((?:int|long|long long)\)\s*{re.escape(var_name)}\s*=\s*(-?\d+)"
                     match = re.search(pattern, output)
                     if match:
                         return int(match.group(1))
@@ -232,7 +245,7 @@ def run_extraction(key_path, filename, lldb_path, program_input=None, program_ar
     Main extraction routine.
     """
     # Parse key file
-    expected_signature, watermarks = parse_key_file(key_path)
+    expected_signature, watermarks, moduli = parse_key_file(key_path)
 
     if not watermarks:
         print(f"{colors.RED}ERROR: No watermarks found in key file{colors.RESET}")
@@ -242,9 +255,12 @@ def run_extraction(key_path, filename, lldb_path, program_input=None, program_ar
     if expected_signature is not None:
         print(f"Expected signature: {expected_signature}")
 
-    # Generate the primes used for CRT (first k primes)
-    primes = generate_primes(len(watermarks))
-    print(f"Using primes: {primes}")
+    # Moduli used for CRT (first k primes for keys without '# moduli=')
+    if moduli is not None and len(moduli) == len(watermarks):
+        primes = moduli
+    else:
+        primes = generate_primes(len(watermarks))
+    print(f"Using moduli: {primes}")
 
     extracted_bi = []
     correct_count = 0
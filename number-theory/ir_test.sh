@@ -0,0 +1,51 @@
+# execute in Tests directory
+# Checks that -nt-low-overhead does not store the watermark values as
+# constants: every b from the key file must be absent from the embedded IR.
+# Also checks that a translation unit without main is watermarked.
+OUT=$(mktemp -d)
+PLUGIN=-load-pass-plugin=./build/number-theory/libNumberTheory.so
+cat > $OUT/loops.c <<'C'
+#include <stdio.h>
+#include <stdlib.h>
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 1000;
+  char *composite = calloc(n + 1, 1);
+  int count = 0;
+  for (int i = 2; i <= n; i++) {
+    if (composite[i])
+      continue;
+    count++;
+    for (int j = 2 * i; j <= n; j += i)
+      composite[j] = 1;
+  }
+  printf("%d\n", count);
+  return 0;
+}
+C
+clang -O1 -g -emit-llvm -c $OUT/loops.c -o $OUT/loops.bc
+opt $PLUGIN -O1 $OUT/loops.bc -o $OUT/loops.ll -S -nt-signature=1234567890123 -nt-keyfile=$OUT/loops.key -nt-low-overhead
+status=0
+for b in $(grep -v '^#' $OUT/loops.key | cut -d' ' -f5); do
+  if grep -qw "i64 $b" $OUT/loops.ll; then
+    echo "FAIL: b=$b is a constant in the embedded IR"
+    status=1
+  fi
+done
+clang $OUT/loops.ll -o $OUT/loops
+test "$($OUT/loops)" = 168 || { echo "FAIL: wrong output"; status=1; }
+# a translation unit without main still gets a watermark
+cat > $OUT/library.c <<'C'
+long sum(const int *values, int n) {
+  long s = 0;
+  for (int i = 0; i < 64 && i < n; i++)
+    s += values[i];
+  return s;
+}
+long (*operations[])(const int *, int) = {sum};
+C
+clang -O1 -g -emit-llvm -c $OUT/library.c -o $OUT/library.bc
+opt $PLUGIN -O1 $OUT/library.bc -o $OUT/library.ll -S -nt-signature=42 -nt-keyfile=$OUT/library.key -nt-low-overhead
+grep -q ' sum ' $OUT/library.key || { echo "FAIL: no watermark without main"; status=1; }
+[ $status = 0 ] && echo "PASS"
+rm -rf $OUT
+exit $status
@@ -0,0 +1,32 @@
+# execute in Tests directory
+# Embeds the C benchmarks in the default mode under -O2 and checks that the
+# optimizer kept every probe intact: only the probe loads (or copies of them
+# made by unrolling or peeling) carry a key's location, and nt-extractor
+# recovers the signature, i.e. the iteration counts in the key still hold.
+OUT=$(mktemp -d)
+PLUGIN=-load-pass-plugin=./build/number-theory/libNumberTheory.so
+status=0
+for program in Benchmarks/*.c; do
+  name=$(basename $program .c)
+  clang -O2 -g -emit-llvm -c $program -o $OUT/$name.bc
+  opt $PLUGIN -O2 $OUT/$name.bc -o $OUT/$name.ll -S -nt-signature=1234567890123 -nt-keyfile=$OUT/$name.key
+  grep -v '^#' $OUT/$name.key | while read line column rest; do
+    for location in $(grep -o "^![0-9]* = !DILocation(line: $line, column: $column," $OUT/$name.ll | cut -d' ' -f1); do
+      if grep "!dbg $location\b" $OUT/$name.ll | grep -qv "load volatile"; then
+        echo "FAIL: $name: $line:$column is not only on the probe"
+        exit 1
+      fi
+    done
+  done || status=1
+  clang $OUT/$name.ll -o $OUT/$name -lm
+  input=
+  [ -f Benchmarks/$name.input ] && input="--input-file Benchmarks/$name.input"
+  if ./build/number-theory/nt-extractor $OUT/$name $OUT/$name.key $input > /dev/null; then
+    echo "PASS: $name"
+  else
+    echo "FAIL: $name: signature not extracted"
+    status=1
+  fi
+done
+rm -rf $OUT
+exit $status
@@ -1,2 +1,20 @@
 # execute in Tests directory
-python test.py --c-compiler "clang -Wno-implicit-int -Wno-implicit-function-declaration -emit-llvm -O1 -g -c [input] -o [output]" --cpp-compiler "clang++ --std=c++2a -Wno-narrowing -emit-llvm -O1 -g -c [input] -o [output]" --embed "opt -load-pass-plugin=./build/number-theory/libNumberTheory.so -O1 [file] -o [file] -S -nt-signature=42" -t 
+python test.py --c-compiler "clang -Wno-implicit-int -Wno-implicit-function-declaration -emit-llvm -O1 -g -c [input] -o [output]" --cpp-compiler "clang++ --std=c++2a -Wno-narrowing -emit-llvm -O1 -g -c [input] -o [output]" --embed "opt -load-pass-plugin=./build/number-theory/libNumberTheory.so -O1 [file] -o [file] -S -time-trace -time-trace-granularity=0 -time-trace-file=[time_trace] -nt-signature=42" -t 
+
+# embed the sieve benchmark in both modes and extract the signature again
+OUT=$(mktemp -d)
+status=0
+for mode in "" -nt-low-overhead; do
+  clang -O1 -g -emit-llvm -c Benchmarks/sieve.c -o $OUT/sieve.bc
+  opt -load-pass-plugin=./build/number-theory/libNumberTheory.so -O1 $OUT/sieve.bc -o $OUT/sieve.bc -nt-signature=1234567890123 -nt-keyfile=$OUT/sieve.key $mode
+  clang $OUT/sieve.bc -o $OUT/sieve
+  if ./build/number-theory/nt-extractor $OUT/sieve $OUT/sieve.key > $OUT/extract.txt; then
+    echo "PASS: nt-extractor $mode"
+  else
+    cat $OUT/extract.txt
+    echo "FAIL: nt-extractor $mode"
+    status=1
+  fi
+done
+rm -rf $OUT
+exit $status
@@ -9,6 +9,7 @@
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Passes/PassPlugin.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 #include <unordered_set>
 using namespace llvm;
@@ -34,7 +35,12 @@ struct RPGMark : public PassInfoMixin<RPGMark> {
     RPG rpg = RPG::from_sip(SIP::encode(message.getValue()));
     CallGraph *cg = new CallGraph(M); // we update it later
     {
-      vector<Function *> mapping = GraphMatcher::match(*cg, rpg);
+      TimeTraceScope scope("RPGMark::embedGraph");
+      vector<Function *> mapping;
+      {
+        TimeTraceScope matchScope("RPGMark::match");
+        mapping = GraphMatcher::match(*cg, rpg);
+      }
       int num_nonnull = 0;
       for (Function *f : mapping)
         if (f)
@@ -47,6 +53,7 @@ struct RPGMark : public PassInfoMixin<RPGMark> {
       delete cg;
       cg = new CallGraph(M);
       GraphMatcher::createMissingEdges(M, *cg, rpg, mapping);
+      GraphMatcher::preserveEdges(M, rpg, mapping);
       llvm::errs() << "Mapped " << num_nonnull << " / " << mapping.size()
                    << " with " << total_funs << " functions\n";
       llvm::errs() << "embedded watermark 1 times\n";
@@ -56,6 +63,7 @@ struct RPGMark : public PassInfoMixin<RPGMark> {
     // as additional calls don't hurt we collect all never-called functions and
     // call them in a reachable function s.t. they are not removed
     {
+      TimeTraceScope scope("RPGMark::connectUnreachable");
       Function *main = M.getFunction("main");
       unordered_set<Function *> reachable;
       reachable.insert(main);
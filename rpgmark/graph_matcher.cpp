@@ -5,9 +5,11 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <queue>
 #include <stdexcept>
 #include <unordered_set>
@@ -61,12 +63,10 @@ vector<Function *> GraphMatcher::match(CallGraph &cg, RPG &rpg) {
             0; // sums of most missing or extranous ingoing and outgoing edges
     Function *minimum = nullptr;
     for (Function &f : cg.getModule()) {
-      if (f.hasExactDefinition() &&
+      // always-inline functions vanish from the call graph, and their
+      // contract is not ours to break
+      if (f.hasExactDefinition() && !f.hasFnAttribute(Attribute::AlwaysInline) &&
           already_assigned.find(&f) == already_assigned.end()) {
-        if (f.hasFnAttribute(Attribute::AlwaysInline)) {
-          f.removeFnAttr(Attribute::AlwaysInline);
-        }
-        f.addFnAttr(Attribute::NoInline);
         int wrong_in = 0, wrong_out = 0;
         CallGraphNode *node = cg[&f];
         unordered_set<Function *> incoming_func;
@@ -75,10 +75,6 @@ vector<Function *> GraphMatcher::match(CallGraph &cg, RPG &rpg) {
           outgoing_func.insert(succ->getFunction());
         }
         for (Function &p : cg.getModule()) {
-          if (p.hasFnAttribute(Attribute::AlwaysInline)) {
-            p.removeFnAttr(Attribute::AlwaysInline);
-          }
-          p.addFnAttr(Attribute::NoInline);
           for (auto [_, p_succ] : *cg[&p]) {
             if (p_succ->getFunction() == &f)
               incoming_func.insert(&p);
@@ -131,15 +127,17 @@ void GraphMatcher::createMissingFunctions(
       if (cloned->hasFnAttribute(Attribute::AlwaysInline)) {
         cloned->removeFnAttr(Attribute::AlwaysInline);
       }
-      cloned->addFnAttr(Attribute::NoInline);
+      // clones are only reached through opaque calls
+      cloned->addFnAttr(Attribute::Cold);
+      cloned->setSectionPrefix("unlikely");
       match[i] = cloned;
     }
   }
 }
 
 /** Creates a call to callee in caller, protected by an opaque predicate on
- * time. The insertion is anchored in the entry block so optimization passes
- * cannot drop it as dead code. */
+ * time. The insertion is anchored in the entry block and the call's result is
+ * stored (volatile), so optimization passes cannot drop it as dead code. */
 void GraphMatcher::insertOpaqueCall(Function *caller, Function *callee) {
   BasicBlock *orig = &caller->getEntryBlock();
   // add new block with original instructions (split)
@@ -168,9 +166,25 @@ void GraphMatcher::insertOpaqueCall(Function *caller, Function *callee) {
       Type *at = arg.getType();
       opaqueCallParams.push_back(Constant::getNullValue(at));
     }
-    callee->addFnAttr(Attribute::NoInline);
     CallInst *call = opaqueBuild.CreateCall(callee, opaqueCallParams);
-    call->setDebugLoc(DILocation::get(caller->getContext(), 0, 0, SP));
+    // a mismatching calling convention (e.g. fastcc after O1) is undefined
+    // behaviour, instcombine would turn the block unreachable
+    call->setCallingConv(callee->getCallingConv());
+    // only this call has to survive, the callee may still be inlined elsewhere
+    call->addFnAttr(Attribute::NoInline);
+    call->addFnAttr(Attribute::Cold);
+    // a call to a function without side effects is dead if its result is
+    // unused, a volatile store into a global keeps it
+    if (!call->getType()->isVoidTy()) {
+      auto *sink = new GlobalVariable(
+          *caller->getParent(), call->getType(), false,
+          GlobalValue::InternalLinkage,
+          Constant::getNullValue(call->getType()), "rpg_sink");
+      opaqueBuild.CreateStore(call, sink, /* isVolatile */ true);
+    }
+    // a function without a subprogram (e.g. a synthetic one) has no scope
+    if (SP)
+      call->setDebugLoc(DILocation::get(caller->getContext(), 0, 0, SP));
     // branch to split
     opaqueBuild.CreateBr(split);
   }
@@ -185,11 +199,15 @@ void GraphMatcher::insertOpaqueCall(Function *caller, Function *callee) {
     FunctionCallee timeFunc = mod->getOrInsertFunction("time", fType);
     CallInst *timeVal =
         origBuild.CreateCall(timeFunc, {Constant::getNullValue(params[0])});
-    timeVal->setDebugLoc(DILocation::get(caller->getContext(), 0, 0, SP));
+    if (SP)
+      timeVal->setDebugLoc(DILocation::get(caller->getContext(), 0, 0, SP));
     Value *pred = origBuild.CreateCmp(
         CmpInst::Predicate::ICMP_SGT, timeVal,
         ConstantInt::get(Type::getInt64Ty(mod->getContext()), rand() % 10000));
-    origBuild.CreateCondBr(pred, split, opaque);
+    // the predicate always holds, so the opaque block is never executed
+    origBuild.CreateCondBr(
+        pred, split, opaque,
+        MDBuilder(mod->getContext()).createBranchWeights((1 << 20) - 1, 1));
   }
 }
 
@@ -218,3 +236,29 @@ void GraphMatcher::createMissingEdges(llvm::Module &m, CallGraph &cg, RPG &rpg,
   if (verifyModule(m, &errs()))
     throw std::runtime_error("");
 }
+
+void GraphMatcher::preserveEdges(llvm::Module &m, RPG &rpg,
+                                 std::vector<llvm::Function *> &match) {
+  unordered_set<Function *> isMapped(match.begin(), match.end());
+  for (int i = 0; i < rpg.adjacency.size(); i++) {
+    for (BasicBlock &bb : *match[i]) {
+      for (Instruction &ins : bb) {
+        CallBase *call = dyn_cast<CallBase>(&ins);
+        Function *callee = call ? call->getCalledFunction() : nullptr;
+        if (!callee || callee->isDeclaration())
+          continue;
+        // an RPG edge, or a call whose inlining would change the calls of
+        // the mapped function
+        bool isEdge = false;
+        for (int j = 0; j < rpg.adjacency.size(); j++)
+          isEdge |= rpg.adjacency[i][j] && callee == match[j];
+        if (isEdge || !isMapped.count(callee))
+          call->addFnAttr(Attribute::NoInline);
+      }
+    }
+  }
+  vector<GlobalValue *> mapped;
+  for (Function *f : match)
+    mapped.push_back(f);
+  appendToCompilerUsed(m, mapped);
+}
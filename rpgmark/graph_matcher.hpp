@@ -25,6 +25,15 @@ void createMissingFunctions(llvm::Module &m,
  */
 void createMissingEdges(llvm::Module &m, llvm::CallGraph &cg, RPG &rpg,
                         std::vector<llvm::Function *> &match);
+/**
+ * Keeps the RPG edges of the final mapping through inlining: their calls get a
+ * call-site noinline and the mapped functions are kept in llvm.compiler.used.
+ * Calls from mapped functions to functions outside the mapping get a call-site
+ * noinline as well, so the inliner cannot change the calls of a mapped
+ * function. No function attributes are changed.
+ */
+void preserveEdges(llvm::Module &m, RPG &rpg,
+                   std::vector<llvm::Function *> &match);
 /** Creates a call to callee in a random basic block in caller, protected by a
  * opaque predicate on time */
 void insertOpaqueCall(llvm::Function *caller, llvm::Function *callee);
@@ -1,2 +1,21 @@
 # execute in Tests directory
-python test.py --embed "opt -load-pass-plugin=./build/rpgmark/libRPGMark.so -O1 [file] -o [file] -S -rpg-message=\"Hi\"" -t 
+python test.py --embed "opt -load-pass-plugin=./build/rpgmark/libRPGMark.so -O1 [file] -o [file] -S -time-trace -time-trace-granularity=0 -time-trace-file=[time_trace] -rpg-message=\"Hi\"" -t 
+
+# embed the C benchmarks under -O2, optimize them again while compiling and
+# check that the extractor still finds every RPG edge
+OUT=$(mktemp -d)
+status=0
+for program in Benchmarks/*.c; do
+  name=$(basename $program .c)
+  clang -O2 -g -emit-llvm -c $program -o $OUT/$name.bc
+  opt -load-pass-plugin=./build/rpgmark/libRPGMark.so -O2 $OUT/$name.bc -o $OUT/$name.bc -rpg-message="Hi" -rpg-keyfile=$OUT/$name.key
+  clang -O2 $OUT/$name.bc -o $OUT/$name -lm
+  if ./build/rpgmark/extractor $OUT/$name "Hi" $OUT/$name.key > /dev/null; then
+    echo "PASS: $name"
+  else
+    echo "FAIL: $name"
+    status=1
+  fi
+done
+rm -rf $OUT
+exit $status
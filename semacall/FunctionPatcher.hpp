@@ -1,16 +1,31 @@
 #ifndef PATCHING_LIBC_FUNCTION_PATCHER_HPP
 #define PATCHING_LIBC_FUNCTION_PATCHER_HPP
 #include "Polynoms.hpp"
+#include <algorithm>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Comdat.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 struct FunctionPatcher {
+  // case of the shared reveal function for each watermarking technique
+  enum Technique { ATOI = 0, GETS = 1, TIME = 2, SIDEDATA = 3 };
+  // instructions the first patch adds at most, including the reveal function,
+  // a polynom and the hash function: 83 (scalar) to 102 (vector hash) on the
+  // tests. It estimates the growth of the first site
+  static constexpr unsigned FIRST_PATCH_INSTRUCTIONS = 102;
   // dispatched when a function with fitting name is found, parameter type
-  // checking still has to be done
-  virtual void patchInstruction(llvm::Function &F, llvm::CallInst &call) = 0;
+  // checking still has to be done. Returns whether the call was patched
+  virtual bool patchInstruction(llvm::Function &F, llvm::CallInst &call) = 0;
   // gets or declares printf with one parameter
   static llvm::FunctionCallee getPrintf(llvm::Module *m) {
     using namespace llvm;
@@ -29,6 +44,120 @@ struct FunctionPatcher {
         FunctionType::get(Type::getInt64Ty(m->getContext()), params, false);
     return m->getOrInsertFunction("strlen", fType);
   }
+  static llvm::FunctionCallee getStrnlen(llvm::Module *m) {
+    using namespace llvm;
+    using namespace std;
+    Type *params[2] = {PointerType::get(Type::getInt8Ty(m->getContext()), 0),
+                       Type::getInt64Ty(m->getContext())};
+    FunctionType *fType =
+        FunctionType::get(Type::getInt64Ty(m->getContext()), params, false);
+    return m->getOrInsertFunction("strnlen", fType);
+  }
+  /**
+   * Branch weights for the watermark checks: the key is (practically) never
+   * passed, so the edge into the check is marked as never taken.
+   */
+  static llvm::MDNode *getUnlikelyWeights(llvm::LLVMContext &ctx) {
+    return llvm::MDBuilder(ctx).createBranchWeights(1, (1 << 20) - 1);
+  }
+  /**
+   * Marks code that only runs when a watermark is revealed as cold and moves
+   * it to .text.unlikely, away from the program's hot code.
+   */
+  static void markCold(llvm::Function *f) {
+    f->addFnAttr(llvm::Attribute::Cold);
+    f->setSectionPrefix("unlikely");
+  }
+  /**
+   * Synthetic helpers are linkonce_odr in their own comdat, so the identical
+   * copies of all translation units fold into one at link time. Their name
+   * has to determine their body.
+   */
+  static void makeMergeable(llvm::GlobalObject *g) {
+    using namespace llvm;
+    g->setLinkage(GlobalValue::LinkOnceODRLinkage);
+    g->setVisibility(GlobalValue::HiddenVisibility);
+    Module *m = g->getParent();
+    if (Triple(m->getTargetTriple()).supportsCOMDAT())
+      g->setComdat(m->getOrInsertComdat(g->getName()));
+  }
+  // deterministic name for a helper whose body depends on `params`
+  static std::string hashedName(const std::string &base,
+                                const std::string &params) {
+    return base + "." +
+           llvm::utohexstr(llvm::xxh3_64bits(llvm::arrayRefFromStringRef(params)),
+                           true);
+  }
+  /**
+   * Prints `f` as if it were alone in a module: its name is dropped and
+   * metadata and attribute groups are numbered from scratch, so equal bodies
+   * print equally in every translation unit.
+   */
+  static std::string printBody(llvm::Function *f) {
+    using namespace llvm;
+    Module scratch("", f->getContext());
+    Function *copy =
+        Function::Create(f->getFunctionType(), f->getLinkage(), "", scratch);
+    ValueToValueMapTy map;
+    auto arg = copy->arg_begin();
+    for (Argument &from : f->args())
+      map[&from] = &*arg++;
+    SmallVector<ReturnInst *, 4> returns;
+    CloneFunctionInto(copy, f, map, CloneFunctionChangeType::DifferentModule,
+                      returns);
+    std::string body;
+    raw_string_ostream os(body);
+    copy->print(os);
+    return os.str();
+  }
+  /**
+   * Emits the call of the reveal function on a patch site's cold edge
+   */
+  static llvm::CallInst *emitRevealCall(llvm::IRBuilder<> &builder,
+                                        llvm::Function *reveal,
+                                        llvm::Value *input, llvm::Value *arg,
+                                        Technique technique) {
+    using namespace llvm;
+    CallInst *call = builder.CreateCall(
+        reveal, {input, arg, builder.getInt32(technique)});
+    call->addFnAttr(Attribute::Cold);
+    return call;
+  }
+  /**
+   * Emits a cheap pre-filter at the end of the builder's block that compares
+   * the first (at most `maxBytes`) characters of `str` with `key` and only
+   * continues to `match` if all of them are equal, else to `miss`.
+   * A character is only loaded once its predecessor matched a non-zero key
+   * character, so the filter never reads past the end of the string. For all
+   * inputs not starting like the key only the first compare is executed.
+   * Afterwards the builder inserts into `match`.
+   */
+  static void emitPrefixFilter(llvm::IRBuilder<> &builder, llvm::Value *str,
+                               const std::string &key, llvm::BasicBlock *match,
+                               llvm::BasicBlock *miss, unsigned maxBytes = 4) {
+    using namespace llvm;
+    LLVMContext &ctx = str->getContext();
+    IntegerType *i8t = Type::getInt8Ty(ctx);
+    IntegerType *i64t = Type::getInt64Ty(ctx);
+    Function *F = builder.GetInsertBlock()->getParent();
+    unsigned n = std::min<unsigned>(key.size(), maxBytes);
+    if (n == 0)
+      builder.CreateBr(match);
+    for (unsigned c = 0; c < n; c++) {
+      Value *character = builder.CreateLoad(
+          i8t, builder.CreateGEP(i8t, str, ConstantInt::get(i64t, c)));
+      Value *cmp = builder.CreateICmpEQ(
+          character, ConstantInt::get(i8t, (unsigned char)key[c]));
+      BasicBlock *next = match;
+      if (c + 1 < n) {
+        next = BasicBlock::Create(ctx, "prefixBlock");
+        next->insertInto(F, match);
+      }
+      builder.CreateCondBr(cmp, next, miss, getUnlikelyWeights(ctx));
+      builder.SetInsertPoint(next);
+    }
+    builder.SetInsertPoint(match);
+  }
   /**
    * For when the instruction from a basic block is transplanted from the
    * original block `orig` to a new block `jump`. Adapts the PHI nodes for all
@@ -174,39 +303,52 @@ struct FunctionPatcher {
     Constant *difference = ConstantInt::get(type, value - currentVal);
     return builder.CreateAdd(lastInst, difference);
   }
+  /**
+   * Returns `watermark_gets_hash(str, limit)`, which hashes `str` up to the
+   * first '\0' or '\n' but never reads more than `limit` characters.
+   */
   static llvm::Function *getHashFunction(llvm::Module *m) {
     using namespace llvm;
     Type *i8pt = PointerType::get(Type::getInt8Ty(m->getContext()), 0);
     IntegerType *i8t = Type::getInt8Ty(m->getContext());
-    IntegerType *i32t = Type::getInt32Ty(m->getContext());
     IntegerType *i64t = Type::getInt64Ty(m->getContext());
     Function *hashfct = m->getFunction("watermark_gets_hash");
     if (!hashfct) {
-      Type *params[1] = {PointerType::get(Type::getInt8Ty(m->getContext()), 0)};
-      FunctionType *fType =
-          FunctionType::get(Type::getInt64Ty(m->getContext()), params, false);
+      Type *params[2] = {i8pt, i64t};
+      FunctionType *fType = FunctionType::get(i64t, params, false);
       hashfct =
           Function::Create(fType, GlobalValue::LinkageTypes::InternalLinkage,
                            "watermark_gets_hash", m);
+      makeMergeable(hashfct);
       BasicBlock *entryBlock = BasicBlock::Create(m->getContext());
       IRBuilder<> entryBuilder(m->getContext());
       entryBuilder.SetInsertPoint(entryBlock);
       Value *stringarg = hashfct->args().begin();
+      Value *limit = hashfct->args().begin() + 1;
+      BasicBlock *boundBlock = BasicBlock::Create(m->getContext());
+      entryBuilder.CreateBr(boundBlock);
       BasicBlock *testBlock = BasicBlock::Create(m->getContext());
-      entryBuilder.CreateBr(testBlock);
       BasicBlock *forBody = BasicBlock::Create(m->getContext());
       BasicBlock *returnBlock = BasicBlock::Create(m->getContext());
       hashfct->insert(hashfct->begin(), entryBlock);
+      hashfct->insert(hashfct->end(), boundBlock);
       hashfct->insert(hashfct->end(), testBlock);
       hashfct->insert(hashfct->end(), forBody);
       hashfct->insert(hashfct->end(), returnBlock);
+      // stop after `limit` characters
+      IRBuilder<> boundBuilder(m->getContext());
+      boundBuilder.SetInsertPoint(boundBlock);
+      PHINode *i = boundBuilder.CreatePHI(i64t, 2);
+      i->addIncoming(ConstantInt::get(i64t, 0), &hashfct->getEntryBlock());
+      PHINode *res = boundBuilder.CreatePHI(i64t, 2);
+      res->addIncoming(ConstantInt::get(i64t, 7), &hashfct->getEntryBlock());
+      boundBuilder.CreateCondBr(boundBuilder.CreateICmpULT(i, limit), testBlock,
+                                returnBlock);
+      // stop at the end of the string or line
       IRBuilder<> testBuilder(m->getContext());
       testBuilder.SetInsertPoint(testBlock);
-      PHINode *i = testBuilder.CreatePHI(i8pt, 2);
-      i->addIncoming(stringarg, &hashfct->getEntryBlock());
-      PHINode *res = testBuilder.CreatePHI(i64t, 2);
-      res->addIncoming(ConstantInt::get(i64t, 7), &hashfct->getEntryBlock());
-      Value *c = testBuilder.CreateLoad(i8t, i);
+      Value *c =
+          testBuilder.CreateLoad(i8t, testBuilder.CreateGEP(i8t, stringarg, i));
       Value *cmp1 =
           ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_NE, c,
                            ConstantInt::get(i8t, '\0'));
@@ -230,9 +372,8 @@ struct FunctionPatcher {
       newres = forBuilder.CreateAdd(newres, cc);
       newres = forBuilder.CreateXor(res, newres);
 
-      Value *indexList[1] = {ConstantInt::get(i64t, 1)};
-      Value *newi = forBuilder.CreateGEP(i8t, i, indexList);
-      forBuilder.CreateBr(testBlock);
+      Value *newi = forBuilder.CreateAdd(i, ConstantInt::get(i64t, 1));
+      forBuilder.CreateBr(boundBlock);
       res->addIncoming(newres, forBody);
       i->addIncoming(newi, forBody);
       ReturnInst::Create(m->getContext(), res, returnBlock);
@@ -240,171 +381,253 @@ struct FunctionPatcher {
     return hashfct;
   }
   /**
-   * Simple rounding function
+   * Emits `name(i32 x) -> i8`, which evaluates the interpolation polynomial
+   * through the points (x[i], y[i]) over Z_p with Horner's method. The
+   * coefficients are stored in a constant array `name_coeffs`. Both are
+   * mergeable, so `name` has to identify the points.
    */
-  static llvm::Function *getRound(llvm::Module *m) {
+  static llvm::Function *emitPolynom(llvm::Module *m, const std::string &name,
+                                     const std::vector<uint64_t> &x,
+                                     const std::vector<uint64_t> &y) {
     using namespace llvm;
     using namespace std;
-    Function *f = m->getFunction("watermark_sidedata_round");
-    if (!f) {
+    LLVMContext &ctx = m->getContext();
+    IntegerType *i8t = Type::getInt8Ty(ctx);
+    IntegerType *i32t = Type::getInt32Ty(ctx);
+    IntegerType *i64t = Type::getInt64Ty(ctx);
+    vector<uint64_t> coeffs = Polynoms::build_polynomial(x, y);
+    if (coeffs.empty() && !x.empty())
+      errs() << "interpolation points of " << name << " are not distinct\n";
+    Type *params[1] = {i32t};
+    FunctionType *fType = FunctionType::get(i8t, params, false);
+    Function *fct = Function::Create(
+        fType, GlobalValue::LinkageTypes::InternalLinkage, name, m);
+    markCold(fct);
+    makeMergeable(fct);
+    BasicBlock *entryBlock = BasicBlock::Create(ctx, "entry", fct);
+    IRBuilder<> builder(entryBlock);
+    if (coeffs.empty()) {
+      builder.CreateRet(ConstantInt::get(i8t, 0));
+      return fct;
+    }
+    ArrayType *coeffType = ArrayType::get(i64t, coeffs.size());
+    GlobalVariable *coeffArray = new GlobalVariable(
+        *m, coeffType, true, GlobalValue::LinkageTypes::PrivateLinkage,
+        ConstantDataArray::get(ctx, ArrayRef<uint64_t>(coeffs)),
+        name + "_coeffs");
+    makeMergeable(coeffArray);
+    Constant *prime = ConstantInt::get(i64t, Polynoms::PRIME);
+    Value *arg = builder.CreateURem(
+        builder.CreateZExt(fct->args().begin(), i64t), prime);
+    BasicBlock *loopBlock = BasicBlock::Create(ctx, "horner", fct);
+    BasicBlock *exitBlock = BasicBlock::Create(ctx, "exit", fct);
+    builder.CreateBr(loopBlock);
+    // res = res * x + a[j] for j = n - 1 ... 0
+    builder.SetInsertPoint(loopBlock);
+    PHINode *j = builder.CreatePHI(i64t, 2);
+    j->addIncoming(ConstantInt::get(i64t, coeffs.size()), entryBlock);
+    PHINode *res = builder.CreatePHI(i64t, 2);
+    res->addIncoming(ConstantInt::get(i64t, 0), entryBlock);
+    Value *nextj = builder.CreateSub(j, ConstantInt::get(i64t, 1));
+    Value *coeff = builder.CreateLoad(
+        i64t, builder.CreateGEP(coeffType, coeffArray,
+                                {ConstantInt::get(i64t, 0), nextj}));
+    Value *nextres = builder.CreateURem(
+        builder.CreateAdd(builder.CreateMul(res, arg), coeff), prime);
+    j->addIncoming(nextj, loopBlock);
+    res->addIncoming(nextres, loopBlock);
+    builder.CreateCondBr(
+        builder.CreateICmpNE(nextj, ConstantInt::get(i64t, 0)), loopBlock,
+        exitBlock);
+    builder.SetInsertPoint(exitBlock);
+    builder.CreateRet(builder.CreateTrunc(nextres, i8t));
 #ifdef DEBUG_PRINTS
-      errs() << "generate round\n";
+    errs() << *fct << "\n";
 #endif
-      IntegerType *i8t = Type::getInt8Ty(m->getContext());
-      IntegerType *i32t = Type::getInt32Ty(m->getContext());
-      Type *f64t = Type::getDoubleTy(m->getContext());
-      Type *params[1] = {Type::getDoubleTy(m->getContext())};
-      FunctionType *fType = FunctionType::get(i8t, params, false);
-      f = Function::Create(fType, GlobalValue::LinkageTypes::InternalLinkage,
-                           "watermark_sidedata_round", m);
-      IRBuilder<> builder(m->getContext());
-      BasicBlock *entryBlock = BasicBlock::Create(m->getContext());
-      f->insert(f->end(), entryBlock);
-      builder.SetInsertPoint(entryBlock);
-      auto arg = f->args().begin();
-      Value *plushalf = builder.CreateFAdd(arg, ConstantFP::get(f64t, 0.5));
-      Value *trunc = builder.CreateFPToSI(plushalf, i8t);
-      builder.CreateRet(trunc);
+    return fct;
+  }
+  /**
+   * Gets or emits the polynom through the points, its name is `name` followed
+   * by a hash of the points
+   */
+  static llvm::Function *getPolynom(llvm::Module *m, const std::string &name,
+                                    const std::vector<uint64_t> &x,
+                                    const std::vector<uint64_t> &y) {
+    std::string points;
+    for (size_t i = 0; i < x.size(); i++)
+      points += std::to_string(x[i]) + ":" + std::to_string(y[i]) + ",";
+    std::string hashed = hashedName(name, points);
+    if (llvm::Function *fct = m->getFunction(hashed))
+      return fct;
 #ifdef DEBUG_PRINTS
-      errs() << *f << "\n";
+    llvm::errs() << "generate poly\n";
 #endif
-    }
-    return f;
+    return emitPolynom(m, hashed, x, y);
   }
+  /**
+   * Generates a polynom that maps the positional encoded values of the
+   * numeric key to val
+   */
   static llvm::Function *generatePolynom(llvm::Module *m, long key,
-                                         std::string val) {
-    using namespace llvm;
+                                         std::string val,
+                                         const std::string &name) {
     using namespace std;
-    Function *fct = m->getFunction("_watermark_polynom");
-    if (!fct) {
-#ifdef DEBUG_PRINTS
-      errs() << "generate poly\n";
-#endif
-      IntegerType *i8t = Type::getInt8Ty(m->getContext());
-      vector<double> x(val.length());
-      vector<double> y(val.length());
-      for (unsigned int i = 0; i < val.size(); i++) {
-        x[i] = key + i * 0xFF;
-        y[i] = val[i];
-      }
-      Lagrange::Operation *op = Lagrange::build_polynomial(x, y);
-      // translate to llvm ir
-      Type *params[1] = {Type::getInt32Ty(m->getContext())};
-      FunctionType *fType =
-          FunctionType::get(Type::getInt8Ty(m->getContext()), params, false);
-      fct = Function::Create(fType, GlobalValue::LinkageTypes::InternalLinkage,
-                             "_watermark_polynom", m);
-      IRBuilder<> builder(m->getContext());
-      BasicBlock *entryBlock = BasicBlock::Create(m->getContext());
-      fct->insert(fct->end(), entryBlock);
-      builder.SetInsertPoint(entryBlock);
-      Type *f64t = Type::getDoubleTy(m->getContext());
-      auto arg = builder.CreateSIToFP(fct->args().begin(), f64t);
-      Value *v = nullptr;
-      for (Lagrange::Equation *sumOp : op->operands) {
-        Lagrange::Operation *prodTerm = (Lagrange::Operation *)sumOp;
-        Value *term = nullptr;
-        for (Lagrange::Equation *eq : prodTerm->operands) {
-          if (eq->eq_type() == Lagrange::VARIABLE) {
-            if (!term)
-              term = arg;
-            else
-              term = builder.CreateFMul(term, arg);
-          } else {
-            Lagrange::Constant *c = (Lagrange::Constant *)eq;
-            if (!term)
-              term = ConstantFP::get(f64t, c->value);
-            else
-              term = builder.CreateFMul(term, ConstantFP::get(f64t, c->value));
-          }
-        }
-        if (!v)
-          v = term;
-        else
-          v = builder.CreateFAdd(v, term);
-      }
-      delete op;
-      if (!v) {
-        errs() << "PANIC v is null: " << op->operands.size() << "\n"
-               << "key: " << key << "val: " << val << "\n"
-               << op->type << "\n";
-      }
-      Value *rounded = builder.CreateCall(getRound(m), {v});
-      builder.CreateRet(rounded);
-#ifdef DEBUG_PRINTS
-      errs() << *fct << "\n";
-#endif
+    vector<uint64_t> x(val.length());
+    vector<uint64_t> y(val.length());
+    for (unsigned int i = 0; i < val.size(); i++) {
+      // the encoding is computed in 32 bit at runtime
+      x[i] = (uint32_t)(key + i * 0xFF);
+      y[i] = (unsigned char)val[i];
     }
-    return fct;
+    return getPolynom(m, name, x, y);
   }
   /**
    * Generates a polynom that maps the positional encoded values in key to val
    */
   static llvm::Function *generatePolynom(llvm::Module *m, std::string key,
-                                         std::string val) {
-    using namespace llvm;
+                                         std::string val,
+                                         const std::string &name) {
     using namespace std;
-    Function *fct = m->getFunction("_watermark_polynom_fitting");
-    if (!fct) {
-#ifdef DEBUG_PRINTS
-      errs() << "generate poly\n";
-#endif
-      IntegerType *i8t = Type::getInt8Ty(m->getContext());
-      vector<double> x(key.length());
-      vector<double> y(val.length());
-      for (unsigned int i = 0; i < key.size(); i++) {
-        x[i] = key[i] + i * 0xFF;
-        y[i] = val[i];
-      }
-      Lagrange::Operation *op = Lagrange::build_polynomial(x, y);
-      // translate to llvm ir
-      Type *params[1] = {Type::getInt32Ty(m->getContext())};
+    vector<uint64_t> x(key.length());
+    vector<uint64_t> y(val.length());
+    for (unsigned int i = 0; i < key.size(); i++) {
+      x[i] = (unsigned char)key[i] + i * 0xFF;
+      y[i] = (unsigned char)val[i];
+    }
+    return getPolynom(m, name, x, y);
+  }
+  // the shared reveal function registered in the module, if there is one
+  static llvm::Function *findRevealFunction(llvm::Module *m) {
+    using namespace llvm;
+    NamedMDNode *registry = m->getNamedMetadata("softwater.reveal");
+    if (!registry || registry->getNumOperands() == 0)
+      return nullptr;
+    return mdconst::dyn_extract_or_null<Function>(
+        registry->getOperand(0)->getOperand(0));
+  }
+  /**
+   * Returns the module's shared reveal function
+   * `watermark_reveal(ptr input, i64 arg, i32 technique)`, which decodes and
+   * prints the watermark of `technique`. Every technique is one case of a
+   * switch and is added on first use: it evaluates `pol` on the `length`
+   * positional encoded characters of `input`, or on the integer `arg` for
+   * TIME, into a static buffer. Patch sites only call it on their cold edge.
+   * The function is registered in the module's `softwater.reveal` named
+   * metadata and its cases in its own `softwater.reveal` metadata. It stays
+   * internal until finalizeRevealFunction names it after its cases.
+   */
+  static llvm::Function *getRevealFunction(llvm::Module *m,
+                                           Technique technique,
+                                           llvm::Function *pol,
+                                           size_t length) {
+    using namespace llvm;
+    LLVMContext &ctx = m->getContext();
+    Type *i8pt = PointerType::get(Type::getInt8Ty(ctx), 0);
+    IntegerType *i8t = Type::getInt8Ty(ctx);
+    IntegerType *i32t = Type::getInt32Ty(ctx);
+    IntegerType *i64t = Type::getInt64Ty(ctx);
+    Function *reveal = findRevealFunction(m);
+    if (!reveal) {
+      Type *params[3] = {i8pt, i64t, i32t};
       FunctionType *fType =
-          FunctionType::get(Type::getInt8Ty(m->getContext()), params, false);
-      fct = Function::Create(fType, GlobalValue::LinkageTypes::InternalLinkage,
-                             "_watermark_polynom_fitting", m);
-      IRBuilder<> builder(m->getContext());
-      BasicBlock *entryBlock = BasicBlock::Create(m->getContext());
-      fct->insert(fct->end(), entryBlock);
-      builder.SetInsertPoint(entryBlock);
-      Type *f64t = Type::getDoubleTy(m->getContext());
-      auto arg = builder.CreateSIToFP(fct->args().begin(), f64t);
-      Value *v = nullptr;
-      for (Lagrange::Equation *sumOp : op->operands) {
-        Lagrange::Operation *prodTerm = (Lagrange::Operation *)sumOp;
-        Value *term = nullptr;
-        for (Lagrange::Equation *eq : prodTerm->operands) {
-          if (eq->eq_type() == Lagrange::VARIABLE) {
-            if (!term)
-              term = arg;
-            else
-              term = builder.CreateFMul(term, arg);
-          } else {
-            Lagrange::Constant *c = (Lagrange::Constant *)eq;
-            if (!term)
-              term = ConstantFP::get(f64t, c->value);
-            else
-              term = builder.CreateFMul(term, ConstantFP::get(f64t, c->value));
-          }
-        }
-        if (!v)
-          v = term;
-        else
-          v = builder.CreateFAdd(v, term);
-      }
-      delete op;
-      if (!v) {
-        errs() << "PANIC v is null: " << op->operands.size() << "\n"
-               << "key: " << key << "val: " << val << "\n"
-               << op->type << "\n";
-      }
-      Value *rounded = builder.CreateCall(getRound(m), {v});
-      builder.CreateRet(rounded);
+          FunctionType::get(Type::getVoidTy(ctx), params, false);
+      reveal =
+          Function::Create(fType, GlobalValue::LinkageTypes::InternalLinkage,
+                           "watermark_reveal", m);
+      reveal->addFnAttr(Attribute::NoInline);
+      markCold(reveal);
+      BasicBlock *entryBlock = BasicBlock::Create(ctx, "entry", reveal);
+      BasicBlock *returnBlock = BasicBlock::Create(ctx, "return", reveal);
+      ReturnInst::Create(ctx, returnBlock);
+      IRBuilder<> entryBuilder(entryBlock);
+      entryBuilder.CreateSwitch(reveal->getArg(2), returnBlock);
+      reveal->setMetadata("softwater.reveal", MDTuple::get(ctx, {}));
+      NamedMDNode *registry = m->getOrInsertNamedMetadata("softwater.reveal");
+      MDNode *entry = MDTuple::get(ctx, {ValueAsMetadata::get(reveal)});
+      if (registry->getNumOperands() == 0)
+        registry->addOperand(entry);
+      else
+        registry->setOperand(0, entry);
+    }
+    SwitchInst *sw = cast<SwitchInst>(reveal->getEntryBlock().getTerminator());
+    ConstantInt *id = ConstantInt::get(i32t, technique);
+    if (sw->findCaseValue(id) != sw->case_default())
+      return reveal;
+    BasicBlock *returnBlock = sw->getDefaultDest();
+    // the buffer lives in the entry block, so it is allocated statically
+    IRBuilder<> allocBuilder(sw);
+    ArrayType *bufferType = ArrayType::get(i8t, length + 1);
+    AllocaInst *buffer = allocBuilder.CreateAlloca(bufferType);
+    BasicBlock *caseBlock = BasicBlock::Create(ctx, "reveal", reveal);
+    BasicBlock *loopBlock = BasicBlock::Create(ctx, "loop", reveal);
+    BasicBlock *eventBlock = BasicBlock::Create(ctx, "event", reveal);
+    sw->addCase(id, caseBlock);
+    IRBuilder<> builder(caseBlock);
+    builder.CreateBr(loopBlock);
+    builder.SetInsertPoint(loopBlock);
+    PHINode *i = builder.CreatePHI(i64t, 2);
+    i->addIncoming(ConstantInt::get(i64t, 0), caseBlock);
+    //  positional encoding
+    Value *base;
+    if (technique == TIME) {
+      base = builder.CreateTrunc(reveal->getArg(1), i32t);
+    } else {
+      Value *character = builder.CreateLoad(
+          i8t, builder.CreateGEP(i8t, reveal->getArg(0), i));
+      base = builder.CreateZExt(character, i32t);
+    }
+    Value *pos = builder.CreateMul(builder.CreateTrunc(i, i32t),
+                                   ConstantInt::get(i32t, 0xFF));
+    //  evaluate polynom and store in buffer
+    Value *y = builder.CreateCall(pol, builder.CreateAdd(base, pos));
+    builder.CreateStore(y, builder.CreateGEP(i8t, buffer, i));
+    Value *newi = builder.CreateAdd(i, ConstantInt::get(i64t, 1));
+    i->addIncoming(newi, loopBlock);
+    builder.CreateCondBr(
+        builder.CreateICmpULT(newi, ConstantInt::get(i64t, length)), loopBlock,
+        eventBlock);
+    //  terminate and print the watermark
+    builder.SetInsertPoint(eventBlock);
+    builder.CreateStore(
+        ConstantInt::get(i8t, '\0'),
+        builder.CreateGEP(i8t, buffer, ConstantInt::get(i64t, length)));
+    builder.CreateCall(getPrintf(m), {buffer});
+    builder.CreateBr(returnBlock);
+    // record the case, finalizeRevealFunction names the function after them
+    std::vector<Metadata *> cases(
+        reveal->getMetadata("softwater.reveal")->op_begin(),
+        reveal->getMetadata("softwater.reveal")->op_end());
+    cases.push_back(MDString::get(
+        ctx, std::to_string(technique) + ":" + pol->getName().str() + ":" +
+                 std::to_string(length)));
+    reveal->setMetadata("softwater.reveal", MDTuple::get(ctx, cases));
 #ifdef DEBUG_PRINTS
-      errs() << *fct << "\n";
+    errs() << *reveal << "\n";
 #endif
-    }
-    return fct;
+    return reveal;
+  }
+  /**
+   * Names the reveal function after its sorted cases and its whole body and
+   * makes it mergeable. Two translation units share a copy only if their
+   * copies are identical. Passes call it once after they added all of their
+   * cases, so the function is renamed once per pass instead of once per case.
+   */
+  static void finalizeRevealFunction(llvm::Module *m) {
+    using namespace llvm;
+    Function *reveal = findRevealFunction(m);
+    if (!reveal)
+      return;
+    std::vector<std::string> cases;
+    for (const MDOperand &op :
+         reveal->getMetadata("softwater.reveal")->operands())
+      cases.push_back(cast<MDString>(op)->getString().str());
+    std::sort(cases.begin(), cases.end());
+    std::string signature;
+    for (const std::string &c : cases)
+      signature += c + ";";
+    signature += printBody(reveal);
+    reveal->setName(hashedName("watermark_reveal", signature));
+    makeMergeable(reveal);
   }
 };
 #endif
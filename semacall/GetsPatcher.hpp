@@ -1,5 +1,5 @@
-#define DONT_USE_POLYNOM
 #include "FunctionPatcher.hpp"
+#include "VectorHash.hpp"
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
@@ -12,6 +12,7 @@
 struct GetsPatcher : public FunctionPatcher {
   static llvm::cl::opt<std::string> GetsWaterMarkKey;
   static llvm::cl::opt<std::string> GetsWaterMarkVal;
+  static llvm::cl::opt<VectorHash::Family> GetsHash;
   static std::string getsWaterMarkKey;
   static std::string getsWaterMarkVal;
   GetsPatcher() {
@@ -29,18 +30,18 @@ struct GetsPatcher : public FunctionPatcher {
       llvm::errs() << "Key is not as long as Value!\n";
     }
   }
-  void patchInstruction(llvm::Function &F, llvm::CallInst &call) override {
+  bool patchInstruction(llvm::Function &F, llvm::CallInst &call) override {
     using namespace llvm;
     if (getsWaterMarkVal.empty() || getsWaterMarkKey.empty()) {
-      return;
+      return false;
     }
-    // 0 gets and fgets, 1 getline
-    const bool callType =
-        call.getCalledFunction()->getName() == "getline" ? 1 : 0;
+    if (getsWaterMarkKey.size() != getsWaterMarkVal.size())
+      return false;
+    // 0 gets and fgets, 1 getline, 2 fread
+    const StringRef name = call.getCalledFunction()->getName();
+    const int callType = name == "getline" ? 1 : name == "fread" ? 2 : 0;
     Module *m = F.getParent();
     Type *i8pt = PointerType::get(Type::getInt8Ty(m->getContext()), 0);
-    IntegerType *i8t = Type::getInt8Ty(F.getContext());
-    IntegerType *i32t = Type::getInt32Ty(F.getContext());
     IntegerType *i64t = Type::getInt64Ty(F.getContext());
     // string operand
     Value *strop = call.getOperand(0);
@@ -64,121 +65,71 @@ struct GetsPatcher : public FunctionPatcher {
         break;
       }
     }
-    // dont mind me, reusing strlen for the hash checking and doing the string
-    // length check in the original block
+    // only inputs as long as the key (with or without the trailing newline)
+    // reach the hash check, the length is taken from the call's result where
+    // possible
+    const size_t keySize = getsWaterMarkKey.size();
+    Value *length;
+    if (callType == 0) {
+      // gets and fgets only return the buffer, so check that something was
+      // read and that it starts like the key before measuring its length
+      BasicBlock *prefixBlock = BasicBlock::Create(F.getContext());
+      BasicBlock *lengthBlock = BasicBlock::Create(F.getContext());
+      lengthBlock->insertInto(&F, hashCheckBlock);
+      prefixBlock->insertInto(&F, lengthBlock);
+      origBuilder.CreateCondBr(origBuilder.CreateIsNotNull(&call), prefixBlock,
+                               jumpBlock);
+      origBuilder.SetInsertPoint(prefixBlock);
+      emitPrefixFilter(origBuilder, strop, getsWaterMarkKey, lengthBlock,
+                       jumpBlock);
+      Value *strnlenParams[2] = {strop, ConstantInt::get(i64t, keySize + 2)};
+      length = origBuilder.CreateCall(getStrnlen(m), strnlenParams);
+    } else if (callType == 1) {
+      length = &call;
+    } else {
+      // fread returns the number of elements read
+      length = origBuilder.CreateMul(&call, call.getOperand(1));
+    }
+    Value *lengthCond = origBuilder.CreateICmpULE(
+        origBuilder.CreateSub(length, ConstantInt::get(i64t, keySize)),
+        ConstantInt::get(i64t, 1));
+    origBuilder.CreateCondBr(lengthCond, hashCheckBlock, jumpBlock,
+                             getUnlikelyWeights(F.getContext()));
     IRBuilder<> hashCheckBuilder(F.getContext());
     hashCheckBuilder.SetInsertPoint(hashCheckBlock);
     // derference line ptr if necessary
     if (callType == 1) {
       strop = hashCheckBuilder.CreateLoad(i8pt, strop);
     }
-    // generate hash jump
-    Value *paramList[1] = {strop};
-    Function *hashfct = getHashFunction(m);
+    // generate hash jump, the hash never reads more than was read by the call
+    Value *paramList[2] = {strop, length};
+    const bool vectorHash = GetsHash == VectorHash::VECTOR;
+    Function *hashfct =
+        vectorHash ? VectorHash::getFunction(m, "watermark_gets_vhash", i64t)
+                   : getHashFunction(m);
     Value *hash = hashCheckBuilder.CreateCall(hashfct, paramList);
-    long keyHash = hashimpl(getsWaterMarkKey.c_str());
+    long keyHash = vectorHash ? VectorHash::reference(getsWaterMarkKey.c_str(),
+                                                      keySize)
+                              : hashimpl(getsWaterMarkKey.c_str());
     long testValue = rand() % 1711922400l;
     hash = transformKeyToValue(hashCheckBuilder, hash, keyHash, testValue);
     Value *cmp =
         ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_EQ, hash,
                          ConstantInt::get(i64t, testValue));
     hashCheckBuilder.Insert(cmp);
-    hashCheckBuilder.CreateCondBr(cmp, easterBlock, jumpBlock);
-    // check string length
-    Value *strlenRes;
-    if (callType == 0) {
-      strlenRes = origBuilder.CreateCall(getStrlen(m), paramList);
-    } else {
-      strlenRes = &call;
-    }
-    Value *strlenCond = origBuilder.CreateICmpEQ(
-        strlenRes, ConstantInt::get(i64t, getsWaterMarkKey.size() + 1));
-    origBuilder.CreateCondBr(strlenCond, hashCheckBlock, jumpBlock);
-    // generate easter block with transformation
-    IRBuilder<> easterBuilder(F.getContext());
-    easterBuilder.SetInsertPoint(easterBlock);
-    // generate easter egg that transforms the key to the value
-    //    char by char with transformKeyToValue
-    AllocaInst *easterString = easterBuilder.CreateAlloca(
-        i8t, ConstantInt::get(i32t, getsWaterMarkVal.size() + 1));
-#ifndef DONT_USE_POLYNOM
-    BasicBlock *easterEventBlock = BasicBlock::Create(F.getContext());
-    F.insert(F.end(), easterEventBlock);
-    Function *pol = FunctionPatcher::generatePolynom(
-        F.getParent(), getsWaterMarkKey, getsWaterMarkVal);
-    BasicBlock *testBlock = BasicBlock::Create(F.getContext());
-    BasicBlock *loopBlock = BasicBlock::Create(F.getContext());
-    F.insert(F.end(), testBlock);
-    F.insert(F.end(), loopBlock);
-    easterBuilder.CreateBr(testBlock);
-    IRBuilder<> testBuilder(F.getContext());
-    testBuilder.SetInsertPoint(testBlock);
-    PHINode *i = testBuilder.CreatePHI(i64t, 2);
-    IRBuilder<> loopBuilder(F.getContext());
-    loopBuilder.SetInsertPoint(loopBlock);
-    i->addIncoming(ConstantInt::get(i64t, 0), easterBlock);
-    // load character
-    Value *character =
-        testBuilder.CreateLoad(i8t, testBuilder.CreateGEP(i8t, strop, i));
-    // test it
-    Value *cmp1 =
-        ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_NE,
-                         character, ConstantInt::get(i8t, '\0'));
-    Value *cmp2 =
-        ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_NE,
-                         character, ConstantInt::get(i8t, '\n'));
-    testBuilder.Insert(cmp1);
-    testBuilder.Insert(cmp2);
-    testBuilder.CreateCondBr(testBuilder.CreateAnd(cmp1, cmp2), loopBlock,
-                             easterEventBlock);
-
-    // create for loop
-    //  positional encoding
-    Value *lowi = loopBuilder.CreateCast(Instruction::CastOps::Trunc, i, i32t);
-    Value *pos = loopBuilder.CreateMul(lowi, ConstantInt::get(i32t, 0xFF));
-    Value *enc =
-        loopBuilder.CreateAdd(loopBuilder.CreateZExt(character, i32t), pos);
-    //  evaluate polynom
-    Value *y = loopBuilder.CreateCall(pol, enc);
-    //  store in target
-    loopBuilder.CreateStore(y, loopBuilder.CreateGEP(i8t, easterString, i));
-    //  increment index
-    Value *newi = loopBuilder.CreateAdd(i, ConstantInt::get(i64t, 1));
-    i->addIncoming(newi, loopBlock);
-    //  jump to test
-    loopBuilder.CreateBr(testBlock);
-    // create easter event
-    IRBuilder<> eventBuilder(F.getContext());
-    eventBuilder.SetInsertPoint(easterEventBlock);
-    eventBuilder.CreateStore(ConstantInt::get(i8t, '\0'),
-                             eventBuilder.CreateGEP(i8t, easterString, i));
-    //  call printf with prepared string
-    eventBuilder.CreateCall(FunctionPatcher::getPrintf(F.getParent()),
-                            easterString);
-    eventBuilder.CreateLifetimeEnd(easterString, nullptr);
-    eventBuilder.CreateBr(jumpBlock);
-    errs() << "embedded watermark 1 times\n";
-#else
-    for (unsigned int c = 0; c < getsWaterMarkVal.size(); c++) {
-      ConstantInt *offset = ConstantInt::get(i32t, c);
-      Value *indexList[1] = {offset};
-      Value *loadAddr = easterBuilder.CreateGEP(i8t, strop, indexList);
-      Value *loadChar = easterBuilder.CreateLoad(i8t, loadAddr);
-      Value *charValue =
-          transformKeyToValue(easterBuilder, loadChar, (signed char) getsWaterMarkKey.at(c),
-                              (signed char) getsWaterMarkVal.at(c));
-      Value *storeAddr = easterBuilder.CreateGEP(i8t, easterString, indexList);
-      easterBuilder.CreateStore(charValue, storeAddr);
-    }
-    Value *indexList[1] = {ConstantInt::get(i32t, getsWaterMarkVal.size())};
-    Value *storeAddr = easterBuilder.CreateGEP(i8t, easterString, indexList);
-    easterBuilder.CreateStore(ConstantInt::get(i8t, '\0'), storeAddr);
-    Value *printParams[1] = {easterString};
-    easterBuilder.CreateCall(getPrintf(m), printParams);
+    hashCheckBuilder.CreateCondBr(cmp, easterBlock, jumpBlock,
+                                  getUnlikelyWeights(F.getContext()));
+    // reveal the watermark out of line
+    Function *pol = generatePolynom(m, getsWaterMarkKey, getsWaterMarkVal,
+                                    "_watermark_polynom_gets");
+    Function *reveal =
+        getRevealFunction(m, GETS, pol, getsWaterMarkVal.size());
+    IRBuilder<> easterBuilder(easterBlock);
+    emitRevealCall(easterBuilder, reveal, strop, ConstantInt::get(i64t, 0),
+                   GETS);
     easterBuilder.CreateBr(jumpBlock);
-    errs() << "embedded watermark " << getsWaterMarkKey.size()
-           << " times\n";
-#endif
+    errs() << "embedded watermark 1 times\n";
+    return true;
   }
 
 private:
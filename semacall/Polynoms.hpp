@@ -1,106 +1,68 @@
 #ifndef LAGRANGE_POLYNOMS
 #define LAGRANGE_POLYNOMS
-#include <cmath>
-#include <Eigen/LU>
+#include <cstdint>
 #include <vector>
-namespace Lagrange {
+/**
+ * Exact polynomial interpolation over the prime field Z_p with p = 2^31 - 1.
+ * Products of two field elements fit into 62 bits, so the generated code can
+ * evaluate the polynomial with plain 64 bit integer arithmetic.
+ */
+namespace Polynoms {
 using namespace std;
-enum EquationType { OPERATION, VARIABLE, CONSTANT };
-struct Equation {
-  virtual ~Equation() = default;
-  virtual double operator()(double x) = 0;
-  virtual EquationType eq_type() = 0;
-};
-struct Operand : public Equation {};
-struct Variable : public Operand {
-  double operator()(double x) override { return x; }
-  EquationType eq_type() override { return VARIABLE; }
-};
-struct Constant : public Operand {
-  double value;
-  Constant() = default;
-  Constant(double value) : value(value) {}
-  double operator()(double x) override { return value; }
-  EquationType eq_type() override { return CONSTANT; }
-};
-enum OperationType { PRODUCT, SUM, DIVISION };
-struct Operation : public Equation {
-  OperationType type;
-  vector<Equation *> operands;
-  static Operation *Sum() {
-    Operation *o = new Operation();
-    o->type = SUM;
-    return o;
-  };
-  static Operation *Product() {
-    Operation *o = new Operation();
-    o->type = PRODUCT;
-    return o;
-  };
-  static Operation *Division() {
-    Operation *o = new Operation();
-    o->type = DIVISION;
-    return o;
-  };
-  Operation() = default;
-  Operation(Operation &&) = delete;
-  Operation &operator=(Operation &&) = delete;
-  Operation(const Operation &o);
-  Operation &operator=(const Operation &) = delete;
-  ~Operation() {
-    for (Equation *op : operands) {
-      if (op)
-        delete op;
-    }
+static constexpr uint64_t PRIME = 2147483647;
+static uint64_t mod_pow(uint64_t base, uint64_t exp) {
+  uint64_t res = 1;
+  base %= PRIME;
+  while (exp) {
+    if (exp & 1)
+      res = res * base % PRIME;
+    base = base * base % PRIME;
+    exp >>= 1;
   }
-  double operator()(double x) override {
-    if (operands.empty())
-      return 0;
-    double res = (*operands[0])(x);
-    for (int i = 1; i < operands.size(); i++) {
-      switch (type) {
-      case SUM:
-        res += (*operands[i])(x);
-        break;
-      case PRODUCT:
-        res *= (*operands[i])(x);
-        break;
-      case DIVISION:
-        res /= (*operands[i])(x);
-        break;
-      }
-    }
-    return res;
+  return res;
+}
+static uint64_t mod_inverse(uint64_t a) { return mod_pow(a, PRIME - 2); }
+/**
+ * Returns the coefficients a_0 ... a_{n-1} (lowest degree first) of the
+ * polynomial of degree < n through the points (x[i], y[i]) in Z_p. Uses
+ * Newton's divided differences and expands the Newton form afterwards, both
+ * in O(n^2). Returns an empty vector if two x values are equal modulo p.
+ */
+static vector<uint64_t> build_polynomial(vector<uint64_t> x,
+                                         vector<uint64_t> y) {
+  const size_t n = x.size();
+  for (size_t i = 0; i < n; i++) {
+    x[i] %= PRIME;
+    y[i] %= PRIME;
   }
-  EquationType eq_type() override { return OPERATION; }
-};
-static Lagrange::Operation *build_polynomial(std::vector<double> x,
-                                             std::vector<double> y) {
-  const int n = x.size();
-  using namespace std;
-  using namespace Eigen;
-  MatrixXd mat(n, n);
-  for (int i = 0; i < n; i++) {
-    for (int j = 0; j < n; j++) {
-      mat(i, j) = pow(x[i], j);
+  // divided differences, afterwards y[i] = f[x_0, ..., x_i]
+  for (size_t j = 1; j < n; j++) {
+    for (size_t i = n - 1; i >= j; i--) {
+      uint64_t dx = (x[i] + PRIME - x[i - j]) % PRIME;
+      if (dx == 0)
+        return {};
+      y[i] = (y[i] + PRIME - y[i - 1]) % PRIME * mod_inverse(dx) % PRIME;
     }
   }
-  mat = mat.inverse();
-  VectorXd yv(n);
-  for (int i = 0; i < n; i++)
-    yv[i] = y[i];
-  VectorXd a = mat * yv;
-  using namespace Lagrange;
-  Operation *sum = Operation::Sum();
-  for (int i = 0; i < n; i++) {
-    Operation *prod = Operation::Product();
-    for (int j = 0; j < i; j++) {
-      prod->operands.push_back(new Variable());
-    }
-    prod->operands.push_back(new Constant(a[i]));
-    sum->operands.push_back(prod);
+  // expand c_0 + (x - x_0)(c_1 + (x - x_1)(c_2 + ...)) from the inside out
+  vector<uint64_t> a(n, 0);
+  for (size_t k = n; k-- > 0;) {
+    // a = a * (x - x_k) + c_k
+    for (size_t i = n - 1; i > 0; i--)
+      a[i] = (a[i - 1] + (PRIME - x[k]) * a[i]) % PRIME;
+    a[0] = ((PRIME - x[k]) * a[0] + y[k]) % PRIME;
   }
-  return sum;
+  return a;
+}
+/**
+ * Horner evaluation, the reference for the generated code
+ */
+static uint64_t evaluate(const vector<uint64_t> &a, uint64_t x) {
+  uint64_t res = 0;
+  x %= PRIME;
+  for (size_t i = a.size(); i-- > 0;)
+    res = (res * x + a[i]) % PRIME;
+  return res;
 }
-} // namespace Lagrange
+} // namespace Polynoms
 #endif
@@ -1,5 +1,6 @@
 #include "AtoiPatcher.hpp"
 #include "GetsPatcher.hpp"
+#include "SiteSelection.hpp"
 #include "TimePatcher.hpp"
 #include <llvm/IR/PassManager.h>
 #include <llvm/Passes/PassPlugin.h>
@@ -23,22 +24,42 @@ struct SemaCall : public llvm::PassInfoMixin<SemaCall> {
 
   static bool isRequired() { return true; }
 
-  llvm::PreservedAnalyses run(llvm::Function &F,
-                              llvm::FunctionAnalysisManager &) {
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM) {
     using namespace llvm;
-    for (auto &bb : F) {
-      for (auto &ins : bb) {
-        if (isa<CallInst>(ins)) {
-          CallInst &call = (CallInst &)ins;
-          Function *f = call.getCalledFunction();
-          if (f && functionPatcher.count(f->getName().str()) != 0) {
-            functionPatcher[f->getName().str()]->patchInstruction(F, call);
-          } else if (f) {
+    FunctionAnalysisManager &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    auto entryCounts = SiteSelection::estimateEntryCounts(M, FAM);
+    // collect all candidates first, patching invalidates the analyses
+    std::vector<SiteSelection::Site> sites;
+    timeTraceProfilerBegin("SemaCall::collectSites", "");
+    for (Function &F : M) {
+      unsigned ordinal = 0;
+      for (auto &bb : F) {
+        for (auto &ins : bb) {
+          if (isa<CallInst>(ins)) {
+            CallInst &call = (CallInst &)ins;
+            Function *f = call.getCalledFunction();
+            if (f && functionPatcher.count(f->getName().str()) != 0) {
+              sites.push_back(
+                  SiteSelection::makeSite(&call, ordinal++, FAM, entryCounts));
+            }
           }
         }
       }
     }
-    return PreservedAnalyses::none();
+    timeTraceProfilerEnd();
+    bool changed = SiteSelection::embed(
+        M, sites, "semacall",
+        FunctionPatcher::FIRST_PATCH_INSTRUCTIONS *
+            SiteSelection::BYTES_PER_INSTRUCTION,
+        [this](SiteSelection::Site &site) {
+          CallInst &call = (CallInst &)*site.inst;
+          return functionPatcher[call.getCalledFunction()->getName().str()]
+              ->patchInstruction(*site.function, call);
+        });
+    FunctionPatcher::finalizeRevealFunction(&M);
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
   }
 };
 using namespace llvm;
@@ -66,6 +87,12 @@ llvm::cl::opt<std::string> GetsPatcher::GetsWaterMarkVal(
     llvm::cl::desc("Specify the watermark value that will be generated once "
                    "gets-key is passed to an gets/fgets invocation"),
     llvm::cl::value_desc("gets-watermark-value"));
+llvm::cl::opt<VectorHash::Family> AtoiPatcher::AtoiHash(
+    "atoi-hash", llvm::cl::desc("Hash family of the atoi watermark check"),
+    VectorHash::familyValues(), llvm::cl::init(VectorHash::SCALAR));
+llvm::cl::opt<VectorHash::Family> GetsPatcher::GetsHash(
+    "gets-hash", llvm::cl::desc("Hash family of the gets watermark check"),
+    VectorHash::familyValues(), llvm::cl::init(VectorHash::SCALAR));
 llvm::cl::opt<long> TimePatcher::TimeWaterMarkKey(
     "time-key",
     llvm::cl::desc("Specify the watermark time key in seconds since the epoch "
@@ -81,13 +108,13 @@ llvm::PassPluginLibraryInfo getSemaCallPluginInfo() {
           [](PassBuilder &PB) {
             PB.registerPipelineParsingCallback(
                 [](auto, ModulePassManager &MPM, auto) {
-                  MPM.addPass(createModuleToFunctionPassAdaptor(SemaCall()));
+                  MPM.addPass(SemaCall());
                   return true;
                 });
             // this one is needed for clang
             PB.registerPipelineEarlySimplificationEPCallback(
                 [](ModulePassManager &MPM, auto, auto) {
-                  MPM.addPass(createModuleToFunctionPassAdaptor(SemaCall()));
+                  MPM.addPass(SemaCall());
                 });
           }};
 }
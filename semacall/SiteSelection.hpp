@@ -0,0 +1,272 @@
+#ifndef SOFTWATER_SITE_SELECTION_HPP
+#define SOFTWATER_SITE_SELECTION_HPP
+#include <algorithm>
+#include <functional>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+/**
+ * Static site selection shared by SemaCall and Sidedata. Candidate sites are
+ * ranked by their estimated execution count (block frequency relative to the
+ * function entry, scaled by how often the function is entered from main) and
+ * loop depth. Only the coldest sites are embedded, at most
+ * -softwater-max-sites of them and only while the -softwater-max-growth
+ * budget lasts.
+ */
+namespace SiteSelection {
+/**
+ * Both plugins may be loaded into the same tool, so an option is only
+ * registered by the first one and looked up by the second.
+ */
+template <typename T>
+static llvm::cl::opt<T> *getSharedOption(const char *name, const char *desc,
+                                         const char *valueDesc, const T &init) {
+  auto &options = llvm::cl::getRegisteredOptions();
+  auto it = options.find(name);
+  if (it != options.end())
+    return static_cast<llvm::cl::opt<T> *>(it->second);
+  return new llvm::cl::opt<T>(llvm::StringRef(name), llvm::cl::desc(desc),
+                              llvm::cl::value_desc(valueDesc),
+                              llvm::cl::init(init));
+}
+static llvm::cl::opt<unsigned> *MaxSites = getSharedOption<unsigned>(
+    "softwater-max-sites",
+    "Embed a watermark in at most this many sites per pass (0: no limit)", "N",
+    0);
+static llvm::cl::opt<std::string> *MaxGrowth = getSharedOption<std::string>(
+    "softwater-max-growth",
+    "Stop embedding once the estimated code growth reaches this many bytes, "
+    "or this percentage of the module's size if followed by %",
+    "bytes|%", "");
+// rough size of an instruction in the final binary
+static constexpr double BYTES_PER_INSTRUCTION = 4;
+struct Site {
+  llvm::Instruction *inst;
+  llvm::Function *function;
+  // position among the candidates of the function
+  unsigned ordinal;
+  // estimated executions per run of the program
+  double frequency;
+  unsigned loopDepth;
+  // stable across builds of the same source, used by profiles
+  std::string id() const {
+    return function->getName().str() + ":" + std::to_string(ordinal);
+  }
+  std::string name() const {
+    std::string res = id();
+    if (const llvm::DebugLoc &loc = inst->getDebugLoc())
+      res += " (line " + std::to_string(loc.getLine()) + ")";
+    return res;
+  }
+};
+// frequency of bb per entry of its function
+static double relativeFrequency(llvm::BlockFrequencyInfo &BFI,
+                                const llvm::BasicBlock *bb) {
+  return (double)BFI.getBlockFreq(bb).getFrequency() /
+         BFI.getEntryFreq().getFrequency();
+}
+/**
+ * Estimates how often each function is entered per run of the program by
+ * propagating relative block frequencies of call sites along the call graph
+ * in reverse post-order (recursive edges are ignored). The roots are main,
+ * which is entered once, and every function whose address is taken, which is
+ * assumed to be called once through a pointer. Functions none of them reaches
+ * count 0, all functions of modules without main count as entered once.
+ */
+static std::unordered_map<const llvm::Function *, double>
+estimateEntryCounts(llvm::Module &M, llvm::FunctionAnalysisManager &FAM) {
+  using namespace llvm;
+  TimeTraceScope scope("SiteSelection::estimateEntryCounts");
+  std::unordered_map<const Function *, double> counts;
+  Function *main = M.getFunction("main");
+  for (Function &F : M) {
+    if (!F.isDeclaration())
+      counts[&F] = !main || F.hasAddressTaken() ? 1 : 0;
+  }
+  if (!main || main->isDeclaration())
+    return counts;
+  auto callees = [](Function *F) {
+    std::vector<std::pair<CallBase *, Function *>> res;
+    for (BasicBlock &bb : *F)
+      for (Instruction &ins : bb)
+        if (CallBase *call = dyn_cast<CallBase>(&ins))
+          if (Function *callee = call->getCalledFunction())
+            if (!callee->isDeclaration())
+              res.push_back({call, callee});
+    return res;
+  };
+  std::vector<Function *> roots{main};
+  for (Function &F : M)
+    if (&F != main && !F.isDeclaration() && F.hasAddressTaken())
+      roots.push_back(&F);
+  // iterative depth first search from every root for the post-order
+  std::vector<Function *> postOrder;
+  std::unordered_set<Function *> visited;
+  std::unordered_map<Function *, std::vector<std::pair<CallBase *, Function *>>>
+      edges;
+  for (Function *root : roots) {
+    if (!visited.insert(root).second)
+      continue;
+    edges[root] = callees(root);
+    std::vector<std::pair<Function *, size_t>> stack{{root, 0}};
+    while (!stack.empty()) {
+      auto &[F, next] = stack.back();
+      if (next < edges[F].size()) {
+        Function *callee = edges[F][next++].second;
+        if (visited.insert(callee).second) {
+          edges[callee] = callees(callee);
+          stack.push_back({callee, 0});
+        }
+      } else {
+        postOrder.push_back(F);
+        stack.pop_back();
+      }
+    }
+  }
+  std::unordered_map<Function *, size_t> order;
+  for (size_t i = 0; i < postOrder.size(); i++)
+    order[postOrder[i]] = postOrder.size() - 1 - i;
+  counts[main] = 1;
+  for (auto it = postOrder.rbegin(); it != postOrder.rend(); it++) {
+    Function *F = *it;
+    BlockFrequencyInfo &BFI = FAM.getResult<BlockFrequencyAnalysis>(*F);
+    for (auto &[call, callee] : edges[F]) {
+      if (order[callee] <= order[F])
+        continue;
+      counts[callee] += counts[F] * relativeFrequency(BFI, call->getParent());
+    }
+  }
+  return counts;
+}
+static Site
+makeSite(llvm::Instruction *inst, unsigned ordinal,
+         llvm::FunctionAnalysisManager &FAM,
+         std::unordered_map<const llvm::Function *, double> &entryCounts) {
+  using namespace llvm;
+  Function *F = inst->getFunction();
+  BlockFrequencyInfo &BFI = FAM.getResult<BlockFrequencyAnalysis>(*F);
+  LoopInfo &LI = FAM.getResult<LoopAnalysis>(*F);
+  return {inst, F, ordinal,
+          entryCounts[F] * relativeFrequency(BFI, inst->getParent()),
+          LI.getLoopDepth(inst->getParent())};
+}
+/**
+ * Parses -softwater-max-growth, returns a negative value if no budget is set
+ */
+static double getGrowthBudget(llvm::Module &M) {
+  std::string budget = MaxGrowth->getValue();
+  if (budget.empty())
+    return -1;
+  bool relative = budget.back() == '%';
+  if (relative)
+    budget.pop_back();
+  double value = std::strtod(budget.c_str(), nullptr);
+  if (!relative)
+    return value;
+  return M.getInstructionCount() * BYTES_PER_INSTRUCTION * value / 100;
+}
+/**
+ * Counts the instructions a patch can change: those of the patched function
+ * and of the functions the techniques add. These are the watermark_*
+ * functions present at the start and every function appended to the module
+ * since. A count visits these and the newly appended functions instead of the
+ * whole module.
+ */
+struct GrowthTracker {
+  llvm::Module &M;
+  std::vector<llvm::Function *> synthetic;
+  // the last function already in `synthetic` or seen by the constructor
+  llvm::Function *last;
+  explicit GrowthTracker(llvm::Module &M) : M(M) {
+    for (llvm::Function &F : M)
+      if (F.getName().starts_with("watermark_") ||
+          F.getName().starts_with("_watermark_"))
+        synthetic.push_back(&F);
+    last = M.empty() ? nullptr : &M.getFunctionList().back();
+  }
+  size_t count(llvm::Function &F) {
+    for (auto it = last ? std::next(last->getIterator()) : M.begin();
+         it != M.end(); ++it)
+      synthetic.push_back(&*it);
+    last = M.empty() ? nullptr : &M.getFunctionList().back();
+    size_t count = F.getInstructionCount();
+    for (llvm::Function *other : synthetic)
+      if (other != &F)
+        count += other->getInstructionCount();
+    return count;
+  }
+};
+/**
+ * Embeds `patch` into the coldest `sites` while the limits allow it and
+ * reports the chosen sites. If a limit is set, sites with an estimated
+ * frequency of 0 are skipped, as they never run unless another translation
+ * unit calls them; without a limit every site is embedded. The budget is
+ * checked before each site against the growth of the previous one, and
+ * against `firstSiteGrowth` (bytes, including the shared functions the first
+ * patch adds) before the first. Returns whether any site was patched.
+ */
+static bool embed(llvm::Module &M, std::vector<Site> &sites,
+                  const std::string &technique, double firstSiteGrowth,
+                  const std::function<bool(Site &)> &patch) {
+  using namespace llvm;
+  TimeTraceScope scope("SiteSelection::embed", technique);
+  std::stable_sort(sites.begin(), sites.end(),
+                   [](const Site &a, const Site &b) {
+                     if (a.frequency != b.frequency)
+                       return a.frequency < b.frequency;
+                     return a.loopDepth < b.loopDepth;
+                   });
+  const unsigned maxSites = MaxSites->getValue();
+  const double budget = getGrowthBudget(M);
+  const bool limited = maxSites || budget >= 0;
+  double growth = 0, lastGrowth = firstSiteGrowth, checks = 0;
+  GrowthTracker tracker(M);
+  std::vector<Site *> chosen;
+  size_t neverRun = 0;
+  for (Site &site : sites) {
+    if (limited && site.frequency <= 0) {
+      neverRun++;
+      continue;
+    }
+    if (maxSites && chosen.size() >= maxSites)
+      break;
+    // the previous site's growth estimates the next one
+    if (budget >= 0 && growth + lastGrowth > budget)
+      break;
+    size_t before = tracker.count(*site.function);
+    if (!patch(site))
+      continue;
+    lastGrowth = (double)(tracker.count(*site.function) - before) *
+                 BYTES_PER_INSTRUCTION;
+    if (chosen.empty() && lastGrowth > firstSiteGrowth)
+      errs() << technique << ": the first site grew " << (size_t)lastGrowth
+             << " bytes, more than its estimate of " << (size_t)firstSiteGrowth
+             << "\n";
+    growth += lastGrowth;
+    checks += site.frequency;
+    chosen.push_back(&site);
+  }
+  errs() << technique << ": embedded " << chosen.size() << " of "
+         << sites.size() << " sites, estimated growth " << (size_t)growth
+         << " bytes, estimated " << format("%.2f", checks)
+         << " checks per run, skipped " << neverRun
+         << " sites that never run\n";
+  for (Site *site : chosen)
+    errs() << "  " << site->name() << " frequency "
+           << format("%.4f", site->frequency) << " loop depth "
+           << site->loopDepth << "\n";
+  return !chosen.empty();
+}
+} // namespace SiteSelection
+#endif
@@ -0,0 +1,157 @@
+#ifndef SOFTWATER_VECTOR_HASH_HPP
+#define SOFTWATER_VECTOR_HASH_HPP
+#include "FunctionPatcher.hpp"
+#include <cstdint>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <string>
+/**
+ * Alternative to the byte-serial watermark hashes. The length of the input is
+ * found with strnlen and memchr (vectorized in every libc), afterwards
+ * LANES bytes per step are folded into LANES independent 32 bit
+ * multiply-add lanes, so there is no loop-carried dependency between bytes.
+ * The lanes are combined once at the end. The hash is emitted as vector IR
+ * and left to the backend to lower to SSE/AVX/NEON.
+ */
+namespace VectorHash {
+enum Family { SCALAR, VECTOR };
+static constexpr unsigned LANES = 16;
+static constexpr uint32_t MULTIPLIER = 0x01000193;
+static constexpr uint32_t LENGTH_MIX = 0x85EBCA6B;
+static constexpr uint32_t laneWeight(unsigned lane) {
+  return 0x9E3779B1u * (2 * lane + 1);
+}
+/**
+ * Values for a per-technique option selecting the hash family
+ */
+static auto familyValues() {
+  return llvm::cl::values(
+      clEnumValN(SCALAR, "scalar", "byte-serial hash (default)"),
+      clEnumValN(VECTOR, "vector", "hash with 16 independent lanes"));
+}
+/**
+ * Reference implementation, used for the key hash at compile time. Hashes
+ * the characters before the first '\0' or '\n', at most `limit` of them.
+ */
+static uint32_t reference(const char *str, uint64_t limit) {
+  uint64_t length = 0;
+  while (length < limit && str[length] != '\0' && str[length] != '\n')
+    length++;
+  uint32_t acc[LANES] = {};
+  const uint64_t full = length & ~(uint64_t)(LANES - 1);
+  for (uint64_t i = 0; i < full; i += LANES)
+    for (unsigned lane = 0; lane < LANES; lane++)
+      acc[lane] = acc[lane] * MULTIPLIER + (uint8_t)str[i + lane];
+  // the tail block is always folded, missing bytes count as 0
+  for (unsigned lane = 0; lane < LANES; lane++)
+    acc[lane] = acc[lane] * MULTIPLIER +
+                (full + lane < length ? (uint8_t)str[full + lane] : 0);
+  uint32_t res = 0;
+  for (unsigned lane = 0; lane < LANES; lane++)
+    res += acc[lane] * laneWeight(lane);
+  res ^= (uint32_t)length * LENGTH_MIX;
+  return res ^ (res >> 15);
+}
+/**
+ * Gets or emits `name(ptr, i64 limit) -> resultType` computing `reference`.
+ * A non-zero `terminating` additionally bounds the limit, like the
+ * terminating parameter of the Sidedata hash. `name` has to determine
+ * `resultType` and `terminating`, the function is mergeable.
+ */
+static llvm::Function *getFunction(llvm::Module *m, const std::string &name,
+                                   llvm::IntegerType *resultType,
+                                   uint64_t terminating = 0) {
+  using namespace llvm;
+  if (Function *hashfct = m->getFunction(name))
+    return hashfct;
+  LLVMContext &ctx = m->getContext();
+  IntegerType *i8t = Type::getInt8Ty(ctx);
+  IntegerType *i32t = Type::getInt32Ty(ctx);
+  IntegerType *i64t = Type::getInt64Ty(ctx);
+  Type *i8pt = PointerType::get(i8t, 0);
+  auto *bytesType = FixedVectorType::get(i8t, LANES);
+  auto *lanesType = FixedVectorType::get(i32t, LANES);
+  Type *params[2] = {i8pt, i64t};
+  Function *hashfct =
+      Function::Create(FunctionType::get(resultType, params, false),
+                       GlobalValue::InternalLinkage, name, m);
+  FunctionPatcher::makeMergeable(hashfct);
+  Value *str = hashfct->getArg(0);
+  Value *limit = hashfct->getArg(1);
+  BasicBlock *entryBlock = BasicBlock::Create(ctx, "entry", hashfct);
+  BasicBlock *blockTest = BasicBlock::Create(ctx, "blockTest", hashfct);
+  BasicBlock *blockBody = BasicBlock::Create(ctx, "blockBody", hashfct);
+  BasicBlock *tailBlock = BasicBlock::Create(ctx, "tail", hashfct);
+  // length of the input, bounded by the limit, '\0' and '\n'
+  IRBuilder<> builder(entryBlock);
+  if (terminating) {
+    Value *term = ConstantInt::get(i64t, terminating);
+    limit = builder.CreateSelect(builder.CreateICmpULT(limit, term), limit,
+                                 term);
+  }
+  FunctionCallee strnlen = m->getOrInsertFunction("strnlen", i64t, i8pt, i64t);
+  FunctionCallee memchr =
+      m->getOrInsertFunction("memchr", i8pt, i8pt, i32t, i64t);
+  Value *length = builder.CreateCall(strnlen, {str, limit});
+  Value *newline =
+      builder.CreateCall(memchr, {str, ConstantInt::get(i32t, '\n'), length});
+  length = builder.CreateSelect(
+      builder.CreateIsNull(newline), length,
+      builder.CreateSub(builder.CreatePtrToInt(newline, i64t),
+                        builder.CreatePtrToInt(str, i64t)));
+  Value *full =
+      builder.CreateAnd(length, ConstantInt::get(i64t, ~(uint64_t)(LANES - 1)));
+  builder.CreateBr(blockTest);
+  Value *multiplier = ConstantVector::getSplat(
+      ElementCount::getFixed(LANES), ConstantInt::get(i32t, MULTIPLIER));
+  // full blocks: acc = acc * MULTIPLIER + bytes
+  builder.SetInsertPoint(blockTest);
+  PHINode *i = builder.CreatePHI(i64t, 2);
+  PHINode *acc = builder.CreatePHI(lanesType, 2);
+  i->addIncoming(ConstantInt::get(i64t, 0), entryBlock);
+  acc->addIncoming(Constant::getNullValue(lanesType), entryBlock);
+  builder.CreateCondBr(builder.CreateICmpULT(i, full), blockBody, tailBlock);
+  builder.SetInsertPoint(blockBody);
+  Value *bytes =
+      builder.CreateAlignedLoad(bytesType, builder.CreateGEP(i8t, str, i),
+                                Align(1));
+  Value *next = builder.CreateAdd(builder.CreateMul(acc, multiplier),
+                                  builder.CreateZExt(bytes, lanesType));
+  acc->addIncoming(next, blockBody);
+  i->addIncoming(builder.CreateAdd(i, ConstantInt::get(i64t, LANES)),
+                 blockBody);
+  builder.CreateBr(blockTest);
+  // the tail is read with a masked load, nothing past the length is touched
+  builder.SetInsertPoint(tailBlock);
+  std::vector<Constant *> laneIndices, weights;
+  for (unsigned lane = 0; lane < LANES; lane++) {
+    laneIndices.push_back(ConstantInt::get(i32t, lane));
+    weights.push_back(ConstantInt::get(i32t, laneWeight(lane)));
+  }
+  Value *rest =
+      builder.CreateTrunc(builder.CreateSub(length, full), i32t);
+  Value *mask = builder.CreateICmpULT(
+      ConstantVector::get(laneIndices),
+      builder.CreateVectorSplat(LANES, rest));
+  Value *tail = builder.CreateMaskedLoad(
+      bytesType, builder.CreateGEP(i8t, str, full), Align(1), mask,
+      Constant::getNullValue(bytesType));
+  Value *lanes = builder.CreateAdd(builder.CreateMul(acc, multiplier),
+                                   builder.CreateZExt(tail, lanesType));
+  // combine the lanes and mix in the length
+  Value *res = builder.CreateAddReduce(
+      builder.CreateMul(lanes, ConstantVector::get(weights)));
+  res = builder.CreateXor(
+      res, builder.CreateMul(builder.CreateTrunc(length, i32t),
+                             ConstantInt::get(i32t, LENGTH_MIX)));
+  res = builder.CreateXor(res,
+                          builder.CreateLShr(res, ConstantInt::get(i32t, 15)));
+  builder.CreateRet(builder.CreateZExtOrTrunc(res, resultType));
+  return hashfct;
+}
+} // namespace VectorHash
+#endif
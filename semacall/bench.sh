@@ -0,0 +1,12 @@
+# execute in Tests directory
+# Prints the time per patched atoi/strtol call for an unpatched and a watermarked
+# build of bench/atoi.c. Run it with two builds of the plugin to compare them.
+OUT=$(mktemp -d)
+clang -O1 -emit-llvm -S ../semacall/bench/atoi.c -o $OUT/atoi.ll
+opt -O1 $OUT/atoi.ll -o $OUT/plain.ll -S
+opt -load-pass-plugin=./build/semacall/libSemaCall.so -O1 $OUT/atoi.ll -o $OUT/wm.ll -S -atoi-key=12345 -atoi-val=water
+clang -O1 $OUT/plain.ll -o $OUT/plain
+clang -O1 $OUT/wm.ll -o $OUT/wm
+echo -n "unpatched:   "; $OUT/plain
+echo -n "watermarked: "; $OUT/wm
+rm -rf $OUT
@@ -0,0 +1,87 @@
+// Micro-benchmark for the watermark hash families: C versions of the
+// byte-serial hash (watermark_gets_hash) and of the 16 lane hash emitted by
+// VectorHash.hpp, hashing strings of several lengths. Prints cycles (TSC
+// ticks on x86, nanoseconds elsewhere) per byte.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS() __rdtsc()
+#define UNIT "cycles"
+#else
+static uint64_t ticks(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+#define TICKS() ticks()
+#define UNIT "ns"
+#endif
+
+#define LANES 16
+// keeps the compiler from hoisting the pure hash calls out of the loops
+#define CLOBBER(ptr) __asm__ volatile("" : : "r"(ptr) : "memory")
+
+static uint64_t __attribute__((noinline))
+scalar_hash(const char *str, uint64_t limit) {
+  uint64_t res = 7;
+  for (uint64_t i = 0; i < limit && str[i] != '\0' && str[i] != '\n'; i++)
+    res = res ^ ((res << 5) + (res >> 2) + (int64_t)str[i]);
+  return res;
+}
+
+static uint32_t __attribute__((noinline))
+vector_hash(const char *str, uint64_t limit) {
+  uint64_t length = strnlen(str, limit);
+  const char *newline = memchr(str, '\n', length);
+  if (newline)
+    length = newline - str;
+  uint32_t acc[LANES] = {0};
+  const uint64_t full = length & ~(uint64_t)(LANES - 1);
+  for (uint64_t i = 0; i < full; i += LANES)
+    for (unsigned lane = 0; lane < LANES; lane++)
+      acc[lane] = acc[lane] * 0x01000193u + (uint8_t)str[i + lane];
+  for (unsigned lane = 0; lane < LANES; lane++)
+    acc[lane] = acc[lane] * 0x01000193u +
+                (full + lane < length ? (uint8_t)str[full + lane] : 0);
+  uint32_t res = 0;
+  for (unsigned lane = 0; lane < LANES; lane++)
+    res += acc[lane] * (0x9E3779B1u * (2 * lane + 1));
+  res ^= (uint32_t)length * 0x85EBCA6Bu;
+  return res ^ (res >> 15);
+}
+
+int main(int argc, char **argv) {
+  const long bytes = argc > 1 ? atol(argv[1]) : 200000000L;
+  static const size_t lengths[] = {8, 16, 64, 256, 4096};
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+    const size_t length = lengths[l];
+    char *str = malloc(length + 1);
+    for (size_t i = 0; i < length; i++)
+      str[i] = 'a' + i % 26;
+    str[length] = '\0';
+    const long reps = bytes / length;
+    uint64_t sum = 0;
+    uint64_t start = TICKS();
+    for (long r = 0; r < reps; r++) {
+      CLOBBER(str);
+      sum += scalar_hash(str, length + 1);
+    }
+    uint64_t scalar = TICKS() - start;
+    start = TICKS();
+    for (long r = 0; r < reps; r++) {
+      CLOBBER(str);
+      sum += vector_hash(str, length + 1);
+    }
+    uint64_t vector = TICKS() - start;
+    printf("%5zu bytes: scalar %.2f, vector %.2f " UNIT " per byte (checksum "
+           "%llu)\n",
+           length, (double)scalar / (reps * length),
+           (double)vector / (reps * length), (unsigned long long)sum);
+    free(str);
+  }
+  return 0;
+}
@@ -0,0 +1,58 @@
+#include "../rpgmark/acutest.h"
+#include "Polynoms.hpp"
+#include <string>
+using namespace std;
+static void check_interpolation(const string &key, const string &val) {
+  vector<uint64_t> x(key.size());
+  vector<uint64_t> y(val.size());
+  for (unsigned int i = 0; i < key.size(); i++) {
+    x[i] = (unsigned char)key[i] + i * 0xFF;
+    y[i] = (unsigned char)val[i];
+  }
+  vector<uint64_t> a = Polynoms::build_polynomial(x, y);
+  TEST_CHECK(a.size() == key.size());
+  for (unsigned int i = 0; i < key.size(); i++) {
+    uint64_t r = Polynoms::evaluate(a, x[i]);
+    TEST_CHECK(r == y[i]);
+    TEST_MSG("position %u: expected %lu, actual %lu", i, y[i], r);
+  }
+}
+void polynom_short() {
+  check_interpolation("A", "B");
+  check_interpolation("key", "val");
+  check_interpolation("\xff\x80\x01", "\x01\xfe\x7f");
+}
+void polynom_long() {
+  string key, val;
+  for (int i = 0; i < 500; i++) {
+    key += (char)('a' + (i * 7) % 26);
+    val += (char)('A' + (i * 11) % 26);
+  }
+  check_interpolation(key, val);
+}
+void polynom_numeric_key() {
+  // positions of a numeric key as generated for the time watermark
+  const long key = 28000000;
+  string val = "Hello World, this is a watermark";
+  vector<uint64_t> x(val.size());
+  vector<uint64_t> y(val.size());
+  for (unsigned int i = 0; i < val.size(); i++) {
+    x[i] = (uint32_t)(key + i * 0xFF);
+    y[i] = (unsigned char)val[i];
+  }
+  vector<uint64_t> a = Polynoms::build_polynomial(x, y);
+  for (unsigned int i = 0; i < val.size(); i++)
+    TEST_CHECK(Polynoms::evaluate(a, x[i]) == y[i]);
+}
+void polynom_duplicate_points() {
+  TEST_CHECK(Polynoms::build_polynomial({5, 5}, {1, 2}).empty());
+  TEST_CHECK(
+      Polynoms::build_polynomial({1, 1 + Polynoms::PRIME}, {1, 2}).empty());
+}
+TEST_LIST = {
+    {"Polynom Short Keys", polynom_short},
+    {"Polynom Long Keys", polynom_long},
+    {"Polynom Numeric Key", polynom_numeric_key},
+    {"Polynom Duplicate Points", polynom_duplicate_points},
+    {NULL, NULL} /* zeroed record marking the end of the list */
+};
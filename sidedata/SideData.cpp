@@ -14,15 +14,13 @@ llvm::PassPluginLibraryInfo getSideDataPluginInfo() {
           [](PassBuilder &PB) {
             PB.registerPipelineParsingCallback(
                 [](auto, ModulePassManager &MPM, auto) {
-                  MPM.addPass(
-                      createModuleToFunctionPassAdaptor(SidedataWatermark()));
+                  MPM.addPass(SidedataWatermark());
                   return true;
                 });
             // this one is needed for clang
             PB.registerPipelineEarlySimplificationEPCallback(
                 [](ModulePassManager &MPM, auto, auto) {
-                  MPM.addPass(
-                      createModuleToFunctionPassAdaptor(SidedataWatermark()));
+                  MPM.addPass(SidedataWatermark());
                 });
           }};
 }
@@ -37,6 +35,34 @@ llvm::cl::opt<std::string> SidedataWatermark::SidedataVal(
     llvm::cl::desc(
         "Specify watermark value that is generated once the key is present"),
     llvm::cl::value_desc("sidedata-watermark-val"));
+llvm::cl::opt<std::string> SidedataWatermark::SidedataProfileGen(
+    "sidedata-profile-gen", llvm::cl::ValueOptional,
+    llvm::cl::desc("Instead of embedding the watermark, count the allocations "
+                   "of every site and append them to the given profile file "
+                   "(default: sidedata.profile) at exit"),
+    llvm::cl::value_desc("profile"));
+llvm::cl::opt<std::string> SidedataWatermark::SidedataProfileUse(
+    "sidedata-profile-use",
+    llvm::cl::desc("Only embed the watermark at sites that are rarely "
+                   "executed according to the given profile and that saw "
+                   "buffers that can hold the key"),
+    llvm::cl::value_desc("profile"));
+llvm::cl::opt<unsigned> SidedataWatermark::SidedataProfileMaxCount(
+    "sidedata-profile-max-count",
+    llvm::cl::desc("Maximum number of allocations of a site per profiled "
+                   "run for it to be embedded (default: 100)"),
+    llvm::cl::init(100));
+llvm::cl::opt<bool> SidedataWatermark::SidedataRuntime(
+    "sidedata-runtime",
+    llvm::cl::desc("Only tag heap allocations and check them in the wrapped "
+                   "free/operator delete of libsoftwater_sidedata_rt instead "
+                   "of inline at every end of life"),
+    llvm::cl::init(false));
+llvm::cl::opt<VectorHash::Family> SidedataWatermark::SidedataHash(
+    "sidedata-hash",
+    llvm::cl::desc("Hash family of the inline Sidedata checks (the runtime "
+                   "always uses the scalar hash)"),
+    VectorHash::familyValues(), llvm::cl::init(VectorHash::SCALAR));
 std::string SidedataWatermark::sidedataVal;
 std::string SidedataWatermark::sidedataKey;
 #ifndef LLVM_BYE_LINK_INTO_TOOLS
@@ -1,4 +1,5 @@
 #include <llvm/ADT/StringExtras.h>
+#include <llvm/Analysis/DomTreeUpdater.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/PostDominators.h>
 #include <llvm/IR/Constants.h>
@@ -15,8 +16,15 @@
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
 #include "../semacall/FunctionPatcher.hpp"
-static int used_tailor = 0;
+#include "../semacall/SiteSelection.hpp"
+#include "../semacall/VectorHash.hpp"
 static llvm::Function *getHashFunction(llvm::Module *m, long terminating) {
   using namespace llvm;
   Type *i8pt = PointerType::get(Type::getInt8Ty(m->getContext()), 0);
@@ -34,6 +42,7 @@ static llvm::Function *getHashFunction(llvm::Module *m, long terminating) {
     hashfct = Function::Create(
         fType, GlobalValue::LinkageTypes::InternalLinkage,
         "watermark_sidedata_hash" + std::to_string(terminating), m);
+    FunctionPatcher::makeMergeable(hashfct);
     BasicBlock *entryBlock = BasicBlock::Create(m->getContext());
     IRBuilder<> entryBuilder(m->getContext());
     entryBuilder.SetInsertPoint(entryBlock);
@@ -122,13 +131,16 @@ static int hashimpl(const char *str, long length) {
   }
   return res;
 }
-static llvm::BasicBlock *getInsertionBlock(llvm::Function &F,
-                                           llvm::Instruction &allocinst) {
+/**
+ * Returns the instruction before which the check for the allocation is
+ * inserted by walking its users: a free (malloc) or the end of the lifetime
+ * (alloca), else the end of the nearest block that post-dominates all usages.
+ */
+static llvm::Instruction *getEndOfLife(llvm::Instruction &allocinst,
+                                       llvm::DominatorTree &dom,
+                                       llvm::LoopInfo &loops,
+                                       llvm::PostDominatorTree &postdom) {
   using namespace llvm;
-  auto dom = DominatorTree(F);
-  auto loops = LoopInfo(dom);
-  BasicBlock *lastRead = nullptr;
-  LifetimeIntrinsic *EOLAlloc = nullptr;
   bool isMalloc =
       isa<CallInst>(&allocinst) &&
       ((CallInst &)allocinst).getCalledFunction() &&
@@ -137,80 +149,91 @@ static llvm::BasicBlock *getInsertionBlock(llvm::Function &F,
   // the last usage. Else code like a = malloc(...); free(a); b = a; might
   // lead to segmentation faults when accessing the data. We rely on "no
   // double frees"
-  for (BasicBlock &bbo : F) {
-    for (Instruction &inso : bbo) {
-      if (!dom.dominates(&allocinst, &inso))
-        continue;
-      if (isMalloc) {
-        if (isa<CallInst>(&inso)) {
-          CallInst &call = (CallInst &)inso;
-          if (call.getCalledFunction() &&
-              call.getCalledFunction()->getName() == "free" &&
-              (Value *)&allocinst == *call.args().begin()) {
-            // either there is no free found yet ...
-            if (!lastRead) {
-              lastRead = &bbo;
-            } else if (!loops.getLoopFor(&bbo)) { // ... or ideally we found a
-                                                  // free outside of loops
-              lastRead = &bbo;
-              break;
-            }
-          }
-        }
-      } else {
-        if (!EOLAlloc)
-          for (unsigned int i = 0; i < inso.getNumOperands(); i++) {
-            if (inso.getOperand(i) == &allocinst)
-              lastRead = &bbo;
-          }
-        if (inso.isLifetimeStartOrEnd()) {
-          LifetimeIntrinsic &life = (LifetimeIntrinsic &)inso;
-          if (life.getOperand(1) == &allocinst &&
-              life.getCalledFunction()->getName().starts_with(
-                  "llvm.lifetime.end")) {
-            lastRead = &bbo;
-            EOLAlloc = &life;
-            break;
-          }
-        }
+  Instruction *eol = nullptr;
+  std::vector<BasicBlock *> usages;
+  for (User *user : allocinst.users()) {
+    Instruction *inso = dyn_cast<Instruction>(user);
+    if (!inso || !dom.dominates(&allocinst, inso))
+      continue;
+    usages.push_back(inso->getParent());
+    if (isMalloc) {
+      CallInst *call = dyn_cast<CallInst>(inso);
+      if (call && call->getCalledFunction() &&
+          call->getCalledFunction()->getName() == "free" &&
+          call->getArgOperand(0) == &allocinst) {
+        // either there is no free found yet or ideally we found a free
+        // outside of loops
+        if (!eol || (loops.getLoopFor(eol->getParent()) &&
+                     !loops.getLoopFor(call->getParent())))
+          eol = call;
       }
+    } else if (IntrinsicInst *life = dyn_cast<IntrinsicInst>(inso)) {
+      if (life->getIntrinsicID() == Intrinsic::lifetime_end)
+        return life;
     }
   }
-  // if no lastRead: collect all usages of the allocation and find the
-  // first basic block that post-dominates all usages
-  if (!lastRead) {
-    PostDominatorTree postdom(F);
-    std::vector<Instruction *> allUsages;
-    for (BasicBlock &bbo : F) {
-      for (Instruction &inso : bbo) {
-        for (unsigned int i = 0; i < inso.getNumOperands(); i++) {
-          if (inso.getOperand(i) == &allocinst)
-            allUsages.push_back(&inso);
-        }
-      }
-    }
-    for (BasicBlock &bbo : F) {
-      // if last instruction post-dominates all usages it becomes lastRead
-      Instruction &last = *(--bbo.end());
-      bool isPostdom = true;
-      for (Instruction *usage : allUsages) {
-        if (!postdom.dominates(&last, usage)) {
-          isPostdom = false;
-          break;
-        }
-      }
-      if (isPostdom && dom.dominates(&allocinst, &last)) {
-        return &bbo;
-      }
-    }
+  if (eol || usages.empty())
+    return eol;
+  BasicBlock *common = usages.front();
+  for (BasicBlock *usage : usages) {
+    common = postdom.findNearestCommonDominator(common, usage);
+    if (!common)
+      return nullptr;
   }
-  return lastRead;
+  if (!dom.dominates(allocinst.getParent(), common))
+    return nullptr;
+  return common->getTerminator();
+}
+// operator new[] and new, only tagged in the runtime mode
+static bool isOperatorNew(llvm::Instruction &allocinst) {
+  auto *call = llvm::dyn_cast<llvm::CallBase>(&allocinst);
+  return call && call->getCalledFunction() &&
+         (call->getCalledFunction()->getName() == "_Znam" ||
+          call->getCalledFunction()->getName() == "_Znwm");
+}
+/**
+ * Returns the first instruction after the allocation where its result is
+ * available. For an invoke that is the start of a new block on its normal
+ * edge; the split keeps the cached dominator tree and loop info valid and
+ * drops the post dominator tree, the inline checks of the same function use
+ * them later.
+ */
+static llvm::Instruction *
+getInsertionPointAfter(llvm::Instruction &allocinst,
+                       llvm::FunctionAnalysisManager &FAM) {
+  using namespace llvm;
+  auto *invoke = dyn_cast<InvokeInst>(&allocinst);
+  if (!invoke)
+    return allocinst.getNextNode();
+  Function &F = *invoke->getFunction();
+  BasicBlock *split =
+      SplitEdge(invoke->getParent(), invoke->getNormalDest(),
+                FAM.getCachedResult<DominatorTreeAnalysis>(F),
+                FAM.getCachedResult<LoopAnalysis>(F));
+  PreservedAnalyses preserved;
+  preserved.preserve<DominatorTreeAnalysis>();
+  preserved.preserve<LoopAnalysis>();
+  FAM.invalidate(F, preserved);
+  return &*split->getFirstInsertionPt();
 }
 struct SidedataWatermark : public llvm::PassInfoMixin<SidedataWatermark> {
   static llvm::cl::opt<std::string> SidedataKey;
   static llvm::cl::opt<std::string> SidedataVal;
+  static llvm::cl::opt<std::string> SidedataProfileGen;
+  static llvm::cl::opt<std::string> SidedataProfileUse;
+  static llvm::cl::opt<unsigned> SidedataProfileMaxCount;
+  static llvm::cl::opt<bool> SidedataRuntime;
+  static llvm::cl::opt<VectorHash::Family> SidedataHash;
   static std::string sidedataKey;
   static std::string sidedataVal;
+  // instructions the first inline check adds at most, including the reveal
+  // function, a polynom and the hash function: 65 (scalar) to 82 (vector
+  // hash) on the tests
+  static constexpr unsigned FIRST_CHECK_INSTRUCTIONS = 82;
+  // instructions the first runtime site adds at most, including the reveal
+  // function, a polynom, the trampoline and the constructor: 40 (malloc) to
+  // 42 (invoked operator new) on the tests
+  static constexpr unsigned FIRST_RUNTIME_INSTRUCTIONS = 42;
   SidedataWatermark() {
     sidedataKey = SidedataKey.getValue();
     sidedataVal = SidedataVal.getValue();
@@ -223,55 +246,37 @@ struct SidedataWatermark : public llvm::PassInfoMixin<SidedataWatermark> {
         sidedataVal = env;
     }
   }
-  void includeWatermark(llvm::Function &F, llvm::BasicBlock &bb,
-                        llvm::Value *size, llvm::Instruction &allocinst,
-                        llvm::Function *hashfct) {
+  bool includeWatermark(llvm::Function &F, llvm::Value *size,
+                        llvm::Instruction &allocinst, llvm::Function *hashfct,
+                        llvm::FunctionAnalysisManager &FAM) {
     using namespace llvm;
-    auto dom = DominatorTree(F);
-    auto loops = LoopInfo(dom);
-    IntegerType *i8t = Type::getInt8Ty(F.getContext());
+    DominatorTree &dom = FAM.getResult<DominatorTreeAnalysis>(F);
+    PostDominatorTree &postdom = FAM.getResult<PostDominatorTreeAnalysis>(F);
+    LoopInfo &loops = FAM.getResult<LoopAnalysis>(F);
     IntegerType *i32t = Type::getInt32Ty(F.getContext());
     IntegerType *i64t = Type::getInt64Ty(F.getContext());
-    int expected = hashimpl(sidedataKey.c_str(), sidedataKey.size());
+    int expected =
+        SidedataHash == VectorHash::VECTOR
+            ? (int)VectorHash::reference(sidedataKey.c_str(), sidedataKey.size())
+            : hashimpl(sidedataKey.c_str(), sidedataKey.size());
 #ifdef DEBUG_PRINTS
     errs() << "hash on key " << expected << "\n";
 #endif
-    // find last usage block of the allocation
-    BasicBlock *lastRead = getInsertionBlock(F, allocinst);
-    if (!lastRead)
-      return;
-    // create new blocks and slice jump instr to jump block
-    BasicBlock *easterBlock = BasicBlock::Create(F.getContext());
-    easterBlock->setName("easterBlock");
-#ifndef DONT_USE_POLYNOM
-    BasicBlock *easterEventBlock = BasicBlock::Create(F.getContext());
-    easterEventBlock->setName("easterEventBlock");
-    F.insert(F.end(), easterEventBlock);
-#endif
-    BasicBlock *jumpBlock = BasicBlock::Create(F.getContext());
-    IRBuilder<> jumpbuilder(F.getContext());
-    jumpbuilder.SetInsertPoint(jumpBlock);
-    jumpBlock->setName("jumpBlock");
-    F.insert(F.end(), easterBlock);
-    F.insert(F.end(), jumpBlock);
-    // move free calls to the array to the jump block
-    std::vector<CallInst *> frees;
-    for (llvm::Instruction &instr : *lastRead) {
-      if (isa<CallInst>(&instr)) {
-        CallInst &call = (CallInst &)instr;
-        if (call.getCalledFunction() &&
-            call.getCalledFunction()->getName() == "free" &&
-            (Value *)&allocinst == *call.args().begin()) {
-          frees.push_back(&call);
-        }
-      }
-    }
-    for (CallInst *free : frees) {
-      free->removeFromParent();
-      jumpbuilder.Insert(free);
-    }
-    jumpBlock->splice(jumpBlock->end(), lastRead, --(lastRead->end()));
-    FunctionPatcher::adaptPHINodes(&*(--jumpBlock->end()), lastRead, jumpBlock);
+    // find the end of life of the allocation
+    Instruction *eol = getEndOfLife(allocinst, dom, loops, postdom);
+    if (!eol)
+      return false;
+    // split before it, the analyses stay valid for the next allocation
+    DomTreeUpdater updater(&dom, &postdom,
+                           DomTreeUpdater::UpdateStrategy::Eager);
+    BasicBlock *lastRead = eol->getParent();
+    BasicBlock *jumpBlock =
+        SplitBlock(lastRead, eol, &updater, &loops, nullptr, "jumpBlock");
+    BasicBlock *easterBlock =
+        BasicBlock::Create(F.getContext(), "easterBlock", &F, jumpBlock);
+    if (Loop *loop = loops.getLoopFor(lastRead))
+      loop->addBasicBlockToLoop(easterBlock, loops);
+    lastRead->getTerminator()->eraseFromParent();
     IRBuilder<> bbbuilder(F.getContext());
     bbbuilder.SetInsertPoint(lastRead);
     // calculate hash from alloc
@@ -287,174 +292,433 @@ struct SidedataWatermark : public llvm::PassInfoMixin<SidedataWatermark> {
         ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_EQ, hash,
                          ConstantInt::get(i32t, expected));
     bbbuilder.Insert(cmp);
-    // TODO check if size of array >= watermark size
+    // the reveal function reads as many characters as the value has
+    Value *sizeCmp = bbbuilder.CreateICmpUGE(
+        size, ConstantInt::get(size->getType(), sidedataVal.size()));
     // create branch to easter-block
-    bbbuilder.CreateCondBr(cmp, easterBlock, jumpBlock);
+    bbbuilder.CreateCondBr(bbbuilder.CreateAnd(cmp, sizeCmp), easterBlock,
+                           jumpBlock,
+                           FunctionPatcher::getUnlikelyWeights(F.getContext()));
     // easter-block: transformation of repeated key to
-    // watermark (iterate with transform instructions)
-    IRBuilder<> easterBuilder(F.getContext());
-    easterBuilder.SetInsertPoint(easterBlock);
-    AllocaInst *easterString = easterBuilder.CreateAlloca(
-        i8t,
-        easterBuilder.CreateAdd(size, ConstantInt::get(size->getType(), 1)));
-    easterString->setName(easterString->getName() + "_sidedata_patch");
-    easterBuilder.CreateLifetimeStart(easterString, nullptr);
-#ifndef DONT_USE_POLYNOM
+    // watermark in the shared reveal function
     Function *pol = FunctionPatcher::generatePolynom(
-        F.getParent(), sidedataKey, sidedataVal);
-    // iterate over key (spoiler: i fucking hate it)
-    BasicBlock *testBlock = BasicBlock::Create(F.getContext());
-    testBlock->setName("testBlock");
-    BasicBlock *loopBlock = BasicBlock::Create(F.getContext());
-    loopBlock->setName("loopBlock");
-    F.insert(F.end(), testBlock);
-    F.insert(F.end(), loopBlock);
-    easterBuilder.CreateBr(testBlock);
-    IRBuilder<> testBuilder(F.getContext());
-    testBuilder.SetInsertPoint(testBlock);
-    PHINode *i = testBuilder.CreatePHI(i64t, 2);
-    IRBuilder<> loopBuilder(F.getContext());
-    loopBuilder.SetInsertPoint(loopBlock);
-    i->addIncoming(ConstantInt::get(i64t, 0), easterBlock);
-    // load character
-    Value *character =
-        testBuilder.CreateLoad(i8t, testBuilder.CreateGEP(i8t, &allocinst, i));
-    // test it
-    Value *cmp1 =
-        ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_NE,
-                         character, ConstantInt::get(i8t, '\0'));
-    Value *cmp2 = ICmpInst::Create(Instruction::ICmp,
-                                   ICmpInst::Predicate::ICMP_ULT, i, size);
-    Value *cmp3 =
-        ICmpInst::Create(Instruction::ICmp, ICmpInst::Predicate::ICMP_NE,
-                         character, ConstantInt::get(i8t, '\n'));
-    testBuilder.Insert(cmp1);
-    testBuilder.Insert(cmp2);
-    testBuilder.Insert(cmp3);
-    testBuilder.CreateCondBr(
-        testBuilder.CreateAnd(cmp3, testBuilder.CreateAnd(cmp1, cmp2)),
-        loopBlock, easterEventBlock);
-
-    // create for loop
-    //  positional encoding
-    Value *lowi = loopBuilder.CreateCast(Instruction::CastOps::Trunc, i, i32t);
-    Value *pos = loopBuilder.CreateMul(lowi, ConstantInt::get(i32t, 0xFF));
-    Value *enc =
-        loopBuilder.CreateAdd(loopBuilder.CreateZExt(character, i32t), pos);
-    //  evaluate polynom
-    Value *y = loopBuilder.CreateCall(pol, enc);
-    //  store in target
-    loopBuilder.CreateStore(y, loopBuilder.CreateGEP(i8t, easterString, i));
-    //  increment index
-    Value *newi = loopBuilder.CreateAdd(i, ConstantInt::get(i64t, 1));
-    i->addIncoming(newi, loopBlock);
-    //  jump to test
-    loopBuilder.CreateBr(testBlock);
-    // create easter event
-    IRBuilder<> eventBuilder(F.getContext());
-    eventBuilder.SetInsertPoint(easterEventBlock);
-    eventBuilder.CreateStore(ConstantInt::get(i8t, '\0'),
-                             eventBuilder.CreateGEP(i8t, easterString, i));
-    //  call printf with prepared string
-    eventBuilder.CreateCall(FunctionPatcher::getPrintf(F.getParent()),
-                            easterString);
-    eventBuilder.CreateLifetimeEnd(easterString, nullptr);
-    eventBuilder.CreateBr(jumpBlock);
-	    errs() << "included sidedata in " << F.getParent()->getName() << ", 1 times\n";
-
-#else
-    for (unsigned int c = 0; c < sidedataVal.size(); c++) {
-      ConstantInt *offset = ConstantInt::get(i32t, c);
-      Value *indexList[1] = {offset};
-      Value *loadAddr = easterBuilder.CreateGEP(i8t, &allocinst, indexList);
-      Value *loadChar = easterBuilder.CreateLoad(i8t, loadAddr);
-      Value *charValue = FunctionPatcher::transformKeyToValue(
-          easterBuilder, loadChar, sidedataKey.at(c), sidedataVal.at(c));
-      used_tailor++;
-      Value *storeAddr = easterBuilder.CreateGEP(i8t, easterString, indexList);
-      easterBuilder.CreateStore(charValue, storeAddr);
-    }
-    Value *indexList[1] = {ConstantInt::get(i32t, sidedataVal.size())};
-    Value *storeAddr = easterBuilder.CreateGEP(i8t, easterString, indexList);
-    easterBuilder.CreateStore(ConstantInt::get(i8t, '\0'), storeAddr);
-    //  call printf with prepared string
-    easterBuilder.CreateCall(FunctionPatcher::getPrintf(F.getParent()),
-                             easterString);
-    easterBuilder.CreateLifetimeEnd(easterString, nullptr);
+        F.getParent(), sidedataKey, sidedataVal, "_watermark_polynom_sidedata");
+    Function *reveal = FunctionPatcher::getRevealFunction(
+        F.getParent(), FunctionPatcher::SIDEDATA, pol, sidedataVal.size());
+    IRBuilder<> easterBuilder(easterBlock);
+    FunctionPatcher::emitRevealCall(easterBuilder, reveal, &allocinst,
+                                    ConstantInt::get(i64t, 0),
+                                    FunctionPatcher::SIDEDATA);
     easterBuilder.CreateBr(jumpBlock);
-#endif
+    updater.applyUpdates({{DominatorTree::Insert, lastRead, easterBlock},
+                          {DominatorTree::Insert, easterBlock, jumpBlock}});
+    errs() << "included sidedata in " << F.getParent()->getName()
+           << ", 1 times\n";
 #ifdef DEBUG_PRINTS
     errs() << llvm::verifyFunction(F, (raw_ostream *)&errs);
 #endif
+    return true;
+  }
+  // size of the allocation in elements as used by the hash check
+  static llvm::Value *getAllocationSize(llvm::Instruction &allocinst) {
+    using namespace llvm;
+    if (isa<AllocaInst>(&allocinst))
+      return ConstantInt::get(Type::getInt64Ty(allocinst.getContext()),
+                              ((AllocaInst &)allocinst)
+                                  .getAllocatedType()
+                                  ->getArrayNumElements());
+    return *((CallBase &)allocinst).arg_begin();
+  }
+  /**
+   * Profile generation: every site counts its allocations in a histogram
+   * over log2 of the size. A destructor appends a header `run <source file>`
+   * and one line per site to the profile file: `<function>:<ordinal>
+   * <allocations> <bucket>:<allocations>...`
+   */
+  void emitProfileCounters(llvm::Module &M,
+                           std::vector<SiteSelection::Site> &sites,
+                           llvm::FunctionAnalysisManager &FAM) {
+    using namespace llvm;
+    if (sites.empty())
+      return;
+    LLVMContext &ctx = M.getContext();
+    IntegerType *i8t = Type::getInt8Ty(ctx);
+    IntegerType *i32t = Type::getInt32Ty(ctx);
+    IntegerType *i64t = Type::getInt64Ty(ctx);
+    Type *i8pt = PointerType::get(i8t, 0);
+    const unsigned buckets = 64;
+    ArrayType *siteType = ArrayType::get(i64t, buckets + 1);
+    ArrayType *countersType = ArrayType::get(siteType, sites.size());
+    GlobalVariable *counters = new GlobalVariable(
+        M, countersType, false, GlobalValue::LinkageTypes::InternalLinkage,
+        ConstantAggregateZero::get(countersType),
+        "__sidedata_profile_counters");
+    std::vector<Constant *> names;
+    for (unsigned i = 0; i < sites.size(); i++) {
+      Instruction &allocinst = *sites[i].inst;
+      Constant *name = ConstantDataArray::getString(ctx, sites[i].id());
+      names.push_back(new GlobalVariable(
+          M, name->getType(), true, GlobalValue::LinkageTypes::PrivateLinkage,
+          name, "__sidedata_profile_site"));
+      // counters[i][0]++, counters[i][1 + log2(size)]++
+      IRBuilder<> builder(getInsertionPointAfter(allocinst, FAM));
+      Value *size =
+          builder.CreateZExtOrTrunc(getAllocationSize(allocinst), i64t);
+      Value *bucket = builder.CreateSub(
+          ConstantInt::get(i64t, buckets),
+          builder.CreateBinaryIntrinsic(Intrinsic::ctlz,
+                                        builder.CreateOr(size, 1),
+                                        builder.getFalse()));
+      for (Value *index : {(Value *)ConstantInt::get(i64t, 0), bucket}) {
+        Value *counter = builder.CreateGEP(
+            countersType, counters,
+            {ConstantInt::get(i64t, 0), ConstantInt::get(i64t, i), index});
+        builder.CreateStore(
+            builder.CreateAdd(builder.CreateLoad(i64t, counter),
+                              ConstantInt::get(i64t, 1)),
+            counter);
+      }
+    }
+    ArrayType *namesType = ArrayType::get(i8pt, names.size());
+    GlobalVariable *nameTable = new GlobalVariable(
+        M, namesType, true, GlobalValue::LinkageTypes::PrivateLinkage,
+        ConstantArray::get(namesType, names), "__sidedata_profile_names");
+    // dump function
+    FunctionType *dumpType = FunctionType::get(Type::getVoidTy(ctx), false);
+    Function *dump =
+        Function::Create(dumpType, GlobalValue::LinkageTypes::InternalLinkage,
+                         "__sidedata_profile_dump", M);
+    BasicBlock *entryBlock = BasicBlock::Create(ctx, "entry", dump);
+    BasicBlock *headerBlock = BasicBlock::Create(ctx, "header", dump);
+    BasicBlock *siteBlock = BasicBlock::Create(ctx, "site", dump);
+    BasicBlock *bucketBlock = BasicBlock::Create(ctx, "bucket", dump);
+    BasicBlock *printBlock = BasicBlock::Create(ctx, "print", dump);
+    BasicBlock *nextBucketBlock = BasicBlock::Create(ctx, "nextBucket", dump);
+    BasicBlock *nextSiteBlock = BasicBlock::Create(ctx, "nextSite", dump);
+    BasicBlock *closeBlock = BasicBlock::Create(ctx, "close", dump);
+    BasicBlock *returnBlock = BasicBlock::Create(ctx, "return", dump);
+    FunctionCallee fopenFct = M.getOrInsertFunction(
+        "fopen", FunctionType::get(i8pt, {i8pt, i8pt}, false));
+    FunctionCallee fprintfFct = M.getOrInsertFunction(
+        "fprintf", FunctionType::get(i32t, {i8pt, i8pt}, true));
+    FunctionCallee fcloseFct = M.getOrInsertFunction(
+        "fclose", FunctionType::get(i32t, {i8pt}, false));
+    std::string path = SidedataProfileGen.getValue();
+    if (path.empty())
+      path = "sidedata.profile";
+    IRBuilder<> builder(entryBlock);
+    // several modules append to the same file
+    Value *file = builder.CreateCall(
+        fopenFct, {builder.CreateGlobalStringPtr(path),
+                   builder.CreateGlobalStringPtr("a")});
+    builder.CreateCondBr(builder.CreateIsNull(file), returnBlock, headerBlock);
+    // counts of different runs and modules are told apart by the header
+    builder.SetInsertPoint(headerBlock);
+    builder.CreateCall(
+        fprintfFct, {file, builder.CreateGlobalStringPtr("run %s\n"),
+                     builder.CreateGlobalStringPtr(M.getSourceFileName())});
+    builder.CreateBr(siteBlock);
+    // one line per site
+    builder.SetInsertPoint(siteBlock);
+    PHINode *i = builder.CreatePHI(i64t, 2);
+    i->addIncoming(ConstantInt::get(i64t, 0), headerBlock);
+    Value *name = builder.CreateLoad(
+        i8pt, builder.CreateGEP(namesType, nameTable,
+                                {ConstantInt::get(i64t, 0), i}));
+    Value *count = builder.CreateLoad(
+        i64t, builder.CreateGEP(countersType, counters,
+                                {ConstantInt::get(i64t, 0), i,
+                                 ConstantInt::get(i64t, 0)}));
+    builder.CreateCall(fprintfFct,
+                       {file, builder.CreateGlobalStringPtr("%s %lu"), name,
+                        count});
+    builder.CreateBr(bucketBlock);
+    // only the buckets that were hit
+    builder.SetInsertPoint(bucketBlock);
+    PHINode *b = builder.CreatePHI(i64t, 2);
+    b->addIncoming(ConstantInt::get(i64t, 0), siteBlock);
+    Value *bucketCount = builder.CreateLoad(
+        i64t, builder.CreateGEP(countersType, counters,
+                                {ConstantInt::get(i64t, 0), i,
+                                 builder.CreateAdd(b, ConstantInt::get(
+                                                          i64t, 1))}));
+    builder.CreateCondBr(builder.CreateIsNull(bucketCount), nextBucketBlock,
+                         printBlock);
+    builder.SetInsertPoint(printBlock);
+    builder.CreateCall(fprintfFct,
+                       {file, builder.CreateGlobalStringPtr(" %lu:%lu"), b,
+                        bucketCount});
+    builder.CreateBr(nextBucketBlock);
+    builder.SetInsertPoint(nextBucketBlock);
+    Value *nextb = builder.CreateAdd(b, ConstantInt::get(i64t, 1));
+    b->addIncoming(nextb, nextBucketBlock);
+    builder.CreateCondBr(
+        builder.CreateICmpULT(nextb, ConstantInt::get(i64t, buckets)),
+        bucketBlock, nextSiteBlock);
+    builder.SetInsertPoint(nextSiteBlock);
+    builder.CreateCall(fprintfFct,
+                       {file, builder.CreateGlobalStringPtr("\n")});
+    Value *nexti = builder.CreateAdd(i, ConstantInt::get(i64t, 1));
+    i->addIncoming(nexti, nextSiteBlock);
+    builder.CreateCondBr(
+        builder.CreateICmpULT(nexti, ConstantInt::get(i64t, sites.size())),
+        siteBlock, closeBlock);
+    builder.SetInsertPoint(closeBlock);
+    builder.CreateCall(fcloseFct, {file});
+    builder.CreateBr(returnBlock);
+    builder.SetInsertPoint(returnBlock);
+    builder.CreateRetVoid();
+    appendToGlobalDtors(M, dump, 0);
+    errs() << "sidedata: profiling " << sites.size() << " sites into " << path
+           << "\n";
   }
-  llvm::PreservedAnalyses run(llvm::Function &F,
-                              llvm::FunctionAnalysisManager &) {
+  /**
+   * Profile use: keeps the sites that end their life in the same function,
+   * allocated at most -sidedata-profile-max-count times per run and saw
+   * buffers that can hold the key. Their allocations per run replace the
+   * static estimate. The end of life is looked up in the current module, the
+   * profile may come from an older build.
+   */
+  void applyProfile(std::vector<SiteSelection::Site> &sites,
+                    llvm::FunctionAnalysisManager &FAM) {
     using namespace llvm;
-    if (sidedataKey.size() == 0 || sidedataVal.size() == 0)
+    struct Entry {
+      std::string source;
+      uint64_t count = 0;
+      uint64_t keySized = 0;
+    };
+    std::unordered_map<std::string, Entry> profile;
+    // number of runs per source file
+    std::unordered_map<std::string, uint64_t> runs;
+    std::string source;
+    std::ifstream in(SidedataProfileUse.getValue());
+    if (!in)
+      errs() << "sidedata: cannot read profile " << SidedataProfileUse
+             << "\n";
+    std::string line;
+    while (std::getline(in, line)) {
+      if (StringRef(line).starts_with("run ")) {
+        source = line.substr(4);
+        runs[source]++;
+        continue;
+      }
+      std::istringstream fields(line);
+      std::string id, bucket;
+      uint64_t count;
+      if (!(fields >> id >> count))
+        continue;
+      // the profile is appended to by every module and run
+      Entry &entry = profile[id];
+      entry.source = source;
+      entry.count += count;
+      while (fields >> bucket) {
+        size_t colon = bucket.find(':');
+        if (colon == std::string::npos)
+          continue;
+        uint64_t b = std::stoull(bucket.substr(0, colon));
+        // the largest size in bucket b is 2^(b+1) - 1
+        if (b >= 63 || (2ull << b) > sidedataKey.size())
+          entry.keySized += std::stoull(bucket.substr(colon + 1));
+      }
+    }
+    std::vector<SiteSelection::Site> kept;
+    for (SiteSelection::Site &site : sites) {
+      auto it = profile.find(site.id());
+      if (it == profile.end() || it->second.keySized == 0)
+        continue;
+      double perRun = (double)it->second.count /
+                      std::max<uint64_t>(runs[it->second.source], 1);
+      if (perRun > SidedataProfileMaxCount)
+        continue;
+      Function &F = *site.function;
+      if (!getEndOfLife(*site.inst, FAM.getResult<DominatorTreeAnalysis>(F),
+                        FAM.getResult<LoopAnalysis>(F),
+                        FAM.getResult<PostDominatorTreeAnalysis>(F)))
+        continue;
+      site.frequency = perRun;
+      kept.push_back(site);
+    }
+    errs() << "sidedata: profile keeps " << kept.size() << " of "
+           << sites.size() << " sites\n";
+    sites = kept;
+  }
+  /**
+   * Runtime mode: heap allocations are only tagged, the check runs once in the
+   * wrapped free/operator delete of libsoftwater_sidedata_rt. The first tagged
+   * site adds a constructor that registers the key length, the key hash and a
+   * trampoline to the reveal function with the runtime. The sites are chosen
+   * like the inline ones. Returns whether any allocation was tagged.
+   */
+  bool emitRuntime(llvm::Module &M, std::vector<SiteSelection::Site> &heapSites,
+                   llvm::FunctionAnalysisManager &FAM) {
+    using namespace llvm;
+    LLVMContext &ctx = M.getContext();
+    IntegerType *i32t = Type::getInt32Ty(ctx);
+    IntegerType *i64t = Type::getInt64Ty(ctx);
+    IntegerType *sizet = M.getDataLayout().getIntPtrType(ctx);
+    Type *i8pt = PointerType::get(Type::getInt8Ty(ctx), 0);
+    FunctionCallee tag = M.getOrInsertFunction(
+        "__softwater_sidedata_tag", Type::getVoidTy(ctx), i8pt, sizet);
+    bool registered = false;
+    auto registerKey = [&]() {
+      // trampoline from the runtime into the shared reveal function
+      Function *pol = FunctionPatcher::generatePolynom(
+          &M, sidedataKey, sidedataVal, "_watermark_polynom_sidedata");
+      Function *reveal = FunctionPatcher::getRevealFunction(
+          &M, FunctionPatcher::SIDEDATA, pol, sidedataVal.size());
+      Function *trampoline = Function::Create(
+          FunctionType::get(Type::getVoidTy(ctx), {i8pt}, false),
+          GlobalValue::InternalLinkage, "watermark_sidedata_runtime_reveal",
+          M);
+      FunctionPatcher::markCold(trampoline);
+      IRBuilder<> builder(BasicBlock::Create(ctx, "entry", trampoline));
+      FunctionPatcher::emitRevealCall(builder, reveal, trampoline->getArg(0),
+                                      ConstantInt::get(i64t, 0),
+                                      FunctionPatcher::SIDEDATA);
+      builder.CreateRetVoid();
+      FunctionCallee registerFct = M.getOrInsertFunction(
+          "__softwater_sidedata_register", Type::getVoidTy(ctx), sizet, i32t,
+          i8pt);
+      Function *ctor = Function::Create(
+          FunctionType::get(Type::getVoidTy(ctx), false),
+          GlobalValue::InternalLinkage, "watermark_sidedata_runtime_register",
+          M);
+      builder.SetInsertPoint(BasicBlock::Create(ctx, "entry", ctor));
+      builder.CreateCall(
+          registerFct,
+          {ConstantInt::get(sizet, sidedataKey.size()),
+           ConstantInt::get(i32t, (unsigned)hashimpl(sidedataKey.c_str(),
+                                                     sidedataKey.size())),
+           trampoline});
+      builder.CreateRetVoid();
+      appendToGlobalCtors(M, ctor, 0);
+    };
+    return SiteSelection::embed(
+        M, heapSites, "sidedata-runtime",
+        FIRST_RUNTIME_INSTRUCTIONS * SiteSelection::BYTES_PER_INSTRUCTION,
+        [&](SiteSelection::Site &site) {
+          if (!registered) {
+            registerKey();
+            registered = true;
+          }
+          CallBase &call = (CallBase &)*site.inst;
+          if (isOperatorNew(call)) {
+            // operator new[] and new are tagged after the call
+            IRBuilder<> builder(getInsertionPointAfter(call, FAM));
+            builder.CreateCall(
+                tag, {&call, builder.CreateZExtOrTrunc(call.getArgOperand(0),
+                                                       sizet)});
+          } else {
+            // malloc is replaced by a wrapper with the same signature that
+            // tags
+            call.setCalledFunction(M.getOrInsertFunction(
+                "__softwater_sidedata_malloc", call.getFunctionType()));
+          }
+          return true;
+        });
+  }
+  llvm::PreservedAnalyses run(llvm::Module &M,
+                              llvm::ModuleAnalysisManager &MAM) {
+    using namespace llvm;
+    const bool profileGen = SidedataProfileGen.getNumOccurrences() > 0;
+    if (!profileGen &&
+        (sidedataKey.size() == 0 || sidedataVal.size() == 0 ||
+         sidedataKey.size() != sidedataVal.size()))
       return PreservedAnalyses::all();
-    used_tailor = 0;
-    IntegerType *i8t = Type::getInt8Ty(F.getContext());
-    IntegerType *i32t = Type::getInt32Ty(F.getContext());
-    IntegerType *i64t = Type::getInt64Ty(F.getContext());
-    Function *hashfct = nullptr;
-    for (BasicBlock &bb : F) {
-      for (Instruction &ins : bb) {
-        if (isa<AllocaInst>(&ins) &&
-            !ins.getName().starts_with("_sidedata_patch")) {
-          AllocaInst &alloc = (AllocaInst &)(ins);
-          alloc.setName(alloc.getName() + "_sidedata_patch");
-          if (!alloc.getAllocatedType() ||
-              ((!alloc.getAllocatedType()->isArrayTy() ||
-                !alloc.getAllocatedType()->getArrayElementType()))) {
+    IntegerType *i64t = Type::getInt64Ty(M.getContext());
+    FunctionAnalysisManager &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    auto entryCounts = SiteSelection::estimateEntryCounts(M, FAM);
+    // collect all array allocations and mallocs first, patching invalidates
+    // the analyses
+    std::vector<SiteSelection::Site> sites;
+    timeTraceProfilerBegin("Sidedata::collectSites", "");
+    for (Function &F : M) {
+      unsigned ordinal = 0;
+      for (BasicBlock &bb : F) {
+        for (Instruction &ins : bb) {
+          if (isa<AllocaInst>(&ins) &&
+              !ins.getName().starts_with("_sidedata_patch")) {
+            AllocaInst &alloc = (AllocaInst &)(ins);
+            alloc.setName(alloc.getName() + "_sidedata_patch");
+            if (!alloc.getAllocatedType() ||
+                ((!alloc.getAllocatedType()->isArrayTy() ||
+                  !alloc.getAllocatedType()->getArrayElementType()))) {
 #ifdef DEBUG_PRINTS
-            errs() << "skip\n";
+              errs() << "skip\n";
 #endif
-            continue;
-          }
+              continue;
+            }
 #ifdef DEBUG_PRINTS
-          errs() << "did not skip\n";
+            errs() << "did not skip\n";
 #endif
-          Instruction &allocinst = alloc;
+            sites.push_back(
+                SiteSelection::makeSite(&alloc, ordinal++, FAM, entryCounts));
+          } else if (auto *call = dyn_cast<CallBase>(&ins)) {
+            // operator new[] and new are collected in every mode, so the
+            // site ids of a profile do not depend on -sidedata-runtime
+            if ((call->getCalledFunction() &&
+                 call->getCalledFunction()->getName() == "malloc") ||
+                isOperatorNew(*call)) {
+              sites.push_back(
+                  SiteSelection::makeSite(call, ordinal++, FAM, entryCounts));
+            }
+          }
+        }
+      }
+    }
+    timeTraceProfilerEnd();
+    if (profileGen) {
+      emitProfileCounters(M, sites, FAM);
+      return sites.empty() ? PreservedAnalyses::all()
+                           : PreservedAnalyses::none();
+    }
+    if (!SidedataProfileUse.empty())
+      applyProfile(sites, FAM);
+    bool changed = false;
+    if (SidedataRuntime) {
+      // heap sites go to the runtime, stack arrays have no free to wrap and
+      // keep their inline checks
+      std::vector<SiteSelection::Site> heapSites, stackSites;
+      for (SiteSelection::Site &site : sites)
+        (isa<AllocaInst>(site.inst) ? stackSites : heapSites).push_back(site);
+      changed = emitRuntime(M, heapSites, FAM);
+      sites = stackSites;
+    } else {
+      // the inline check needs a free, it has none for operator delete
+      std::vector<SiteSelection::Site> inlineSites;
+      for (SiteSelection::Site &site : sites)
+        if ((isa<AllocaInst>(site.inst) || isa<CallInst>(site.inst)) &&
+            !isOperatorNew(*site.inst))
+          inlineSites.push_back(site);
+      sites = inlineSites;
+    }
+    Function *hashfct = nullptr;
+    changed |= SiteSelection::embed(
+        M, sites, "sidedata",
+        FIRST_CHECK_INSTRUCTIONS * SiteSelection::BYTES_PER_INSTRUCTION,
+        [&](SiteSelection::Site &site) {
+          Instruction &allocinst = *site.inst;
           // get the allocation size
-          Value *size = ConstantInt::get(
-              i32t, alloc.getAllocatedType()->getArrayNumElements());
+          Value *size = getAllocationSize(allocinst);
           if (size->getType()->isIntegerTy(32)) {
             auto exz = CastInst::Create(Instruction::CastOps::ZExt, size, i64t);
-            exz->insertAfter(&alloc);
+            exz->insertAfter(&allocinst);
             size = exz;
           }
           if (!hashfct)
-            hashfct = getHashFunction(F.getParent(), sidedataKey.size());
-          includeWatermark(F, bb, size, allocinst, hashfct);
-          // return PreservedAnalyses::none();
-        } else if (isa<CallInst>(&ins)) {
-          CallInst &call = (CallInst &)(ins);
-          if (call.getCalledFunction() &&
-              call.getCalledFunction()->getName() == "malloc") {
-            // this is where the fun begins
-            Instruction &allocinst = call;
-            // get the allocation size
-            Value *size = *call.arg_begin();
-            if (size->getType()->isIntegerTy(32)) {
-              auto exz =
-                  CastInst::Create(Instruction::CastOps::ZExt, size, i64t);
-              exz->insertAfter(&call);
-              size = exz;
-            }
-            if (!hashfct)
-              hashfct = getHashFunction(F.getParent(), sidedataKey.size());
-            includeWatermark(F, bb, size, allocinst, hashfct);
-            // return PreservedAnalyses::none();
-          }
-        }
-      }
-    }
-#ifdef DONT_USE_POLYNOM
-    if (used_tailor > 0)
-      errs() << "included in " << F.getName() << ", "
-             << F.getParent()->getName() << ", " << used_tailor << " times\n";
-#endif
-    return hashfct == nullptr ? PreservedAnalyses::all()
-                              : PreservedAnalyses::none();
+            hashfct = SidedataHash == VectorHash::VECTOR
+                          ? VectorHash::getFunction(
+                                &M,
+                                "watermark_sidedata_vhash" +
+                                    std::to_string(sidedataKey.size()),
+                                Type::getInt32Ty(M.getContext()),
+                                sidedataKey.size())
+                          : getHashFunction(&M, sidedataKey.size());
+          return includeWatermark(*site.function, size, allocinst, hashfct,
+                                  FAM);
+        });
+    FunctionPatcher::finalizeRevealFunction(&M);
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
   }
 };
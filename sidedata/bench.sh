@@ -0,0 +1,18 @@
+# execute in Tests directory
+# Prints the time per malloc/free pair of bench/malloc_free.c for an unpatched
+# build, the inline checks at every free and the -sidedata-runtime mode.
+OUT=$(mktemp -d)
+PLUGIN=-load-pass-plugin=./build/sidedata/libSideData.so
+KEY="-sidedata-key=12345 -sidedata-val=water"
+WRAP=-Wl,--wrap=free,--wrap=realloc,--wrap=_ZdlPv,--wrap=_ZdaPv,--wrap=_ZdlPvm,--wrap=_ZdaPvm
+clang -O1 -emit-llvm -S ../sidedata/bench/malloc_free.c -o $OUT/bench.ll
+opt -O1 $OUT/bench.ll -o $OUT/plain.ll -S
+opt $PLUGIN -O1 $OUT/bench.ll -o $OUT/inline.ll -S $KEY
+opt $PLUGIN -O1 $OUT/bench.ll -o $OUT/runtime.ll -S $KEY -sidedata-runtime
+clang -O1 $OUT/plain.ll -o $OUT/plain
+clang -O1 $OUT/inline.ll -o $OUT/inline
+clang++ -O1 $OUT/runtime.ll -o $OUT/runtime $WRAP ./build/sidedata/libsoftwater_sidedata_rt.a
+echo -n "unpatched: "; $OUT/plain
+echo -n "inline:    "; $OUT/inline
+echo -n "runtime:   "; $OUT/runtime
+rm -rf $OUT
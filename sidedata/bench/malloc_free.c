@@ -0,0 +1,32 @@
+// Micro-benchmark for Sidedata: allocates, fills and frees buffers of mixed
+// sizes (some of them in the size class of a 5 byte key, none holds the key)
+// in a tight loop and prints the time per malloc/free pair in nanoseconds.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PAIRS 20000000L
+
+static const size_t sizes[] = {5, 8, 16, 6, 32, 64, 12, 128,
+                               7, 24, 256, 10, 48, 20, 96, 9};
+
+int main(int argc, char **argv) {
+  const long n = argc > 1 ? atol(argv[1]) : PAIRS;
+  const int sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+  struct timespec start, end;
+  long sum = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long i = 0; i < n; i++) {
+    size_t size = sizes[i % sizeCount];
+    char *buffer = malloc(size);
+    memset(buffer, 'a' + i % 26, size - 1);
+    buffer[size - 1] = '\0';
+    sum += strlen(buffer) + buffer[0];
+    free(buffer);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  printf("%.2f ns per malloc/free (checksum %ld)\n", ns / n, sum);
+  return 0;
+}
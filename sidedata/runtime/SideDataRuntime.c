@@ -0,0 +1,196 @@
+// Runtime of the Sidedata watermark for -sidedata-runtime. Instead of a check
+// at every free site, free, realloc and operator delete are wrapped at link
+// time:
+//   -Wl,--wrap=free,--wrap=realloc,--wrap=_ZdlPv,--wrap=_ZdaPv,--wrap=_ZdlPvm,
+//   --wrap=_ZdaPvm
+// Only buffers that the pass tagged on allocation and whose usable size is
+// the size class of the key are hashed, everything else costs one
+// malloc_usable_size per free.
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void __real_free(void *ptr);
+void *__real_realloc(void *ptr, size_t size);
+void __real__ZdlPv(void *ptr);
+void __real__ZdaPv(void *ptr);
+void __real__ZdlPvm(void *ptr, size_t size);
+void __real__ZdaPvm(void *ptr, size_t size);
+
+// set of tagged buffers: open addressing with linear probing, EMPTY ends a
+// probe sequence, DELETED does not. Before more than half of the slots are in
+// use (DELETED included) the table is rebuilt without DELETED and grown to
+// hold every tagged buffer.
+// Only buffers of the key's size class get here, the lock is not taken for
+// any other free.
+#define INITIAL_SLOTS 4096
+#define EMPTY ((uintptr_t)0)
+#define DELETED ((uintptr_t)1)
+static pthread_mutex_t tags_lock = PTHREAD_MUTEX_INITIALIZER;
+static uintptr_t *tags;
+static size_t tag_slots;
+static size_t tags_used;
+
+static size_t key_length;
+static uint32_t key_hash;
+static size_t key_class;
+static void (*_Atomic reveal)(const char *);
+
+// tag_slots is a power of two
+static size_t tag_slot(uintptr_t ptr, size_t slots) {
+  return (size_t)((ptr >> 4) * 0x9E3779B97F4A7C15ull >> 32) & (slots - 1);
+}
+
+static void insert(uintptr_t *table, size_t slots, uintptr_t p) {
+  size_t slot = tag_slot(p, slots);
+  while (table[slot] != EMPTY && table[slot] != DELETED)
+    slot = (slot + 1) & (slots - 1);
+  table[slot] = p;
+}
+
+// rehashes into a table of at least 4 slots per tagged buffer, drops DELETED
+static int grow(void) {
+  size_t live = 0;
+  for (size_t i = 0; i < tag_slots; i++)
+    live += tags[i] != EMPTY && tags[i] != DELETED;
+  size_t slots = tag_slots ? tag_slots : INITIAL_SLOTS;
+  while (slots < 4 * (live + 1))
+    slots *= 2;
+  uintptr_t *table = calloc(slots, sizeof(uintptr_t));
+  if (!table)
+    return 0;
+  for (size_t i = 0; i < tag_slots; i++)
+    if (tags[i] != EMPTY && tags[i] != DELETED)
+      insert(table, slots, tags[i]);
+  // free is wrapped, the old table must not be checked
+  __real_free(tags);
+  tags = table;
+  tag_slots = slots;
+  tags_used = live;
+  return 1;
+}
+
+static void tag(void *ptr) {
+  pthread_mutex_lock(&tags_lock);
+  if (2 * (tags_used + 1) > tag_slots && !grow()) {
+    pthread_mutex_unlock(&tags_lock);
+    fprintf(stderr, "softwater: out of memory, buffer %p is not checked\n",
+            ptr);
+    return;
+  }
+  size_t slot = tag_slot((uintptr_t)ptr, tag_slots);
+  while (tags[slot] != EMPTY && tags[slot] != DELETED)
+    slot = (slot + 1) & (tag_slots - 1);
+  // a reused DELETED slot is already counted
+  tags_used += tags[slot] == EMPTY;
+  tags[slot] = (uintptr_t)ptr;
+  pthread_mutex_unlock(&tags_lock);
+}
+
+static int untag(void *ptr) {
+  int found = 0;
+  pthread_mutex_lock(&tags_lock);
+  if (tag_slots) {
+    size_t slot = tag_slot((uintptr_t)ptr, tag_slots);
+    for (; tags[slot] != EMPTY; slot = (slot + 1) & (tag_slots - 1)) {
+      if (tags[slot] == (uintptr_t)ptr) {
+        tags[slot] = DELETED;
+        found = 1;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&tags_lock);
+  return found;
+}
+
+// same hash as watermark_sidedata_hash
+static uint32_t hash(const char *str, size_t limit) {
+  uint32_t res = 7;
+  for (size_t i = 0; i < limit && str[i] != '\0' && str[i] != '\n'; i++)
+    res = res ^ ((res << 5) + (res >> 2) + (uint32_t)(int32_t)str[i]);
+  return res;
+}
+
+static void check(void *ptr) {
+  void (*fct)(const char *) = reveal;
+  if (!fct || !ptr || malloc_usable_size(ptr) != key_class || !untag(ptr))
+    return;
+  if (hash((const char *)ptr, key_length) == key_hash)
+    fct((const char *)ptr);
+}
+
+// called by a constructor of every module compiled with -sidedata-runtime
+void __softwater_sidedata_register(size_t length, uint32_t expected,
+                                   void (*fct)(const char *)) {
+  if (reveal)
+    return;
+  void *probe = malloc(length);
+  if (!probe)
+    return;
+  key_class = malloc_usable_size(probe);
+  __real_free(probe);
+  key_length = length;
+  key_hash = expected;
+  reveal = fct;
+}
+
+void __softwater_sidedata_tag(void *ptr, size_t size) {
+  if (ptr && reveal && size >= key_length &&
+      malloc_usable_size(ptr) == key_class)
+    tag(ptr);
+}
+
+void *__softwater_sidedata_malloc(size_t size) {
+  void *ptr = malloc(size);
+  __softwater_sidedata_tag(ptr, size);
+  return ptr;
+}
+
+void __wrap_free(void *ptr) {
+  check(ptr);
+  __real_free(ptr);
+}
+
+// the buffer lives on at the new address, so its tag moves along
+void *__wrap_realloc(void *ptr, size_t size) {
+  if (!ptr || !reveal || malloc_usable_size(ptr) != key_class)
+    return __real_realloc(ptr, size);
+  if (size == 0) {
+    // frees the buffer
+    check(ptr);
+    return __real_realloc(ptr, size);
+  }
+  if (!untag(ptr))
+    return __real_realloc(ptr, size);
+  void *res = __real_realloc(ptr, size);
+  if (res)
+    __softwater_sidedata_tag(res, size);
+  else
+    tag(ptr);
+  return res;
+}
+
+void __wrap__ZdlPv(void *ptr) {
+  check(ptr);
+  __real__ZdlPv(ptr);
+}
+
+void __wrap__ZdaPv(void *ptr) {
+  check(ptr);
+  __real__ZdaPv(ptr);
+}
+
+void __wrap__ZdlPvm(void *ptr, size_t size) {
+  check(ptr);
+  __real__ZdlPvm(ptr, size);
+}
+
+void __wrap__ZdaPvm(void *ptr, size_t size) {
+  check(ptr);
+  __real__ZdaPvm(ptr, size);
+}
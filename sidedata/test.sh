@@ -1,2 +1,4 @@
 # execute in Tests directory
-python test.py --embed "opt -load-pass-plugin=./build/sidedata/libSideData.so -O1 [file] -o [file] -S -sidedata-key=12345 -sidedata-val=water" -t 
+python test.py --embed "opt -load-pass-plugin=./build/sidedata/libSideData.so -O1 [file] -o [file] -S -time-trace -time-trace-granularity=0 -time-trace-file=[time_trace] -sidedata-key=12345 -sidedata-val=water" -t 
+# the runtime mode, heap allocations are checked by the wrapped free
+python test.py --embed "opt -load-pass-plugin=./build/sidedata/libSideData.so -O1 [file] -o [file] -S -sidedata-key=12345 -sidedata-val=water -sidedata-runtime" --compile "clang++ [input] -o [output] -O1 -lm -Wl,--wrap=free,--wrap=realloc,--wrap=_ZdlPv,--wrap=_ZdaPv,--wrap=_ZdlPvm,--wrap=_ZdaPvm ./build/sidedata/libsoftwater_sidedata_rt.a" -t